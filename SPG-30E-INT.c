@@ -13,6 +13,15 @@
 
 #include <p18f4431.h>
 #include "xlcd.h"
+#include "motor.h"
+#include "control.h"
+#include "encoder.h"
+#include "serial.h"
+#include "trace.h"
+#include "current.h"
+#include "stack.h"
+#include "config.h"
+#include "compare.h"
 #include "delays.h"
 
 //=============================================================================
@@ -24,6 +33,7 @@
 #pragma	config PWRTEN = OFF			// PWRT disabled
 #pragma	config BOREN = OFF			// Brown-out Reset disabled in hardware and software 
 #pragma	config WDTEN = OFF			// WDT disabled (control is placed on the SWDTEN bit)
+#pragma	config WDPS = 128			// WDT postscale 1:128, about 0.5s
 #pragma	config MCLRE = ON			// MCLR pin enabled; RE3 input pin disabled 
 #pragma	config LVP = OFF			// Single-Supply ICSP disabled 
 
@@ -36,9 +46,9 @@
 #define sw1			PORTBbits.RB0
 #define sw2			PORTBbits.RB1
 
-#define cw	{LATBbits.LATB2=1; LATBbits.LATB3=0;}				// Motor clockwise turn
-#define ccw {LATBbits.LATB2=0; LATBbits.LATB3=1;}				// Motor counter-clockwise turn
-#define brake {LATBbits.LATB2=0; LATBbits.LATB3=0; CCPR2L=255;}	// Motor brake
+#if NUM_AXES > 1
+#error "SPG-30E-INT.c decodes a single encoder on INT0/INT1, use SPG-30E-QEI.c for more axes"
+#endif
 
 //=============================================================================
 //	Function Prototypes
@@ -46,20 +56,33 @@
 void Delay_1msX (unsigned int miliseconds);
 void Delay_100msX (unsigned int msec);
 void DelayAndPositionDisplay(unsigned char count);
+void IdleWait(void);
+void MoveTo(unsigned int position);
+void ServiceCommand(void);
+void Home(void);
+void CalibrateBacklash(void);
 void ISRHigh(void);
 void ISRLow(void);
 
 //=============================================================================
 //	Global Variables
 //=============================================================================
-unsigned char PIDEnable=0;
-unsigned int t, CurrentPosition=0, DesirePosition;
+unsigned int t;
+#if SERIAL_BUS
+unsigned int GoTick;				// Start tick of the next 'G' (refer ServiceCommand)
+unsigned char GoAt = 0;
+#endif
 
 //=============================================================================
 //	Main Program
 //=============================================================================
 void main (void)
 {		
+	unsigned char WatchdogReset;
+
+	WatchdogReset = !RCONbits.TO;	// Watchdog timeout since the last run (refer ISRHigh)
+	OpenStack();					// Return stack flags and software stack fill (refer stack.h)
+
 	// Set I/O input output
 	TRISA = 0b11111111;
 	TRISB = 0b00000011;	
@@ -68,27 +91,40 @@ void main (void)
 	ANSEL0 = 0b11100111;		// RA3 and RA4 set as digital input
 	PORTB = 0;					// Clear Port B
 	PORTD = 0;					// Clear Port D
+	OpenControl();				// Clear position and controller state
 	
-	// Configuration for PWM output (controlling motor speed)
-	T2CON  	= 0b00000101;		// Timer 2 on
-	CCP2CON = 0b00001100;		// PWM mode
-	PR2	  	= 0b11111111;		// PR2 set to 255
+	// Configuration for PWM output (controlling motor speed), refer motor.h for backends
+	OpenMotor();
+#if CURRENT_SENSE
+	OpenCurrent();				// Current sampled near the start of the PWM period (refer current.h)
+#endif
 
 	// Configuration for timer interrupt (100Hz, PID control update use)
-	T1CON	= 0b00000001;		
+	T1CON	= 0b10000001;		// Timer 1 on, 16 bits read (refer control.h)
 	RCONbits.IPEN	= 1;
 	INTCONbits.GIE	= 1;
 	INTCONbits.PEIE	= 1;
 	PIE1bits.TMR1IE = 1;
 	IPR1bits.TMR1IP = 1;
 	PIR1bits.TMR1IF = 0;
+	WDTCONbits.SWDTEN = 1;		// Watchdog on, cleared by every control tick
 	
 	// Configuration for external interrupt pin
+	DFLTCON = ENCODER_FILTER;							// Noise filter on INT0 (refer encoder.h)
+	OpenEncoder(0, (PORTCbits.RC4<<1)|PORTCbits.RC3);	// Starting state of the encoder
+	INTCON2bits.INTEDG0 = !PORTCbits.RC3;				// Wait for the edge away from the current level
+	INTCON2bits.INTEDG1 = !PORTCbits.RC4;
 	INTCONbits.INT0IE = 1;
 	INTCONbits.INT0IF = 0;
 	INTCON3bits.INT1IE = 1;
 	INTCON3bits.INT1IF = 0;
 	
+	// Configuration for serial commands (refer ServiceCommand)
+	OpenTrace();
+	OpenSerial();
+	OpenConfig();				// Gains and bus address from the EEPROM record (refer config.h)
+	OpenCompare();				// Trigger output on RC0, no positions yet (refer compare.h)
+	
 	Delay_1msX(1);				// Delay for 1ms
 	
 	// Configuration for external LCD  	
@@ -96,7 +132,9 @@ void main (void)
 	ClearXLCD();		             	// Clear display
 	
 	// Program start here
-	putrsXLCD("SPG-30E Quad Enc");		// Send string to LCD
+	if(WatchdogReset) putrsXLCD("Watchdog reset  ");	// Control tick stopped, motor stays braked until a switch is pressed
+	else if(StackFlags) putrsXLCD("Stack reset     ");	// Return stack overflow or underflow
+	else putrsXLCD("SPG-30E Quad Enc");	// Send string to LCD
 	SetCurXLCD(20);						// Cursor go to lower line (refer xlcd.c for detail)
 	putrsXLCD("Position:");				// Send string to LCD	
 
@@ -104,37 +142,47 @@ void main (void)
 
 	while(1)
 	{
+#if SERIAL_BUS
+		if(PIDEnable)					// Drive enabled by a bus 'G', the bus has the motor now
+		{
+			while(1) DelayAndPositionDisplay(1);	// Bus commands only, SW1/SW2 are no longer read (PCPWM drives RB0/RB1)
+		}
+#endif
 		if(!sw1)						// Test for SW1 pressing
 		{
-			PIDEnable = 1;				// Enable interrupt for PID control
+			StartMotor();				// PWM takes over the motor pins
+			PIDEnable = AXIS_ALL;		// Enable interrupt for PID control
+			Home();						// Find position 0
 			while(1)					// Motor running for mode 1
 			{
-				DesirePosition=120;
+				MoveTo(120);
 				DelayAndPositionDisplay(70);
-				DesirePosition=210;
+				MoveTo(210);
 				DelayAndPositionDisplay(70);
-				DesirePosition=300;
+				MoveTo(300);
 				DelayAndPositionDisplay(70);
-				DesirePosition=390;
+				MoveTo(390);
 				DelayAndPositionDisplay(70);
-				DesirePosition=480;
+				MoveTo(480);
 				DelayAndPositionDisplay(70);
-				DesirePosition=390;
+				MoveTo(390);
 				DelayAndPositionDisplay(70);
-				DesirePosition=300;
+				MoveTo(300);
 				DelayAndPositionDisplay(70);
-				DesirePosition=210;
+				MoveTo(210);
 				DelayAndPositionDisplay(70);		
 			}
 		}
 		else if(!sw2)					// Test for SW2 pressing
 		{
-			PIDEnable = 1;				// Enable interrupt for PID control
+			StartMotor();				// PWM takes over the motor pins
+			PIDEnable = AXIS_ALL;		// Enable interrupt for PID control
+			Home();						// Find position 0
 			while(1)					// Motor running for mode 2			
 			{ 	
-				DesirePosition=120;
+				MoveTo(120);
 				DelayAndPositionDisplay(250);	
-				DesirePosition=1200;	
+				MoveTo(1200);	
 				DelayAndPositionDisplay(250);		
 			}	
 		}		
@@ -151,19 +199,258 @@ void main (void)
 *       Parameters:     count: amount of delay	(max= 255)			*
 *       Description:    This routine generates various delays 		*
 *						while displaying current position 			*
-*						on LCD.										*
+*						on LCD. While every axis is parked the CPU	*
+*						idles instead, the position is not changing.*
 ********************************************************************/
 void DelayAndPositionDisplay(unsigned char count)
 {
 	unsigned char x, y;
 	for(x=0; x<count; x++)
 	{
-		SetCurXLCD(30);					// Set cursor to location 30 (refer xlcd.c for detail)
-		putnumXLCD(CurrentPosition,5);	// Displaying current position on LCD 
+		if(ControlIdle()) IdleWait();	// Parked, sleep through the time of an LCD refresh
+		else if(!ShedTicks)				// LCD and serial are shed while the control tick is overloaded
+		{
+			SetCurXLCD(30);				// Set cursor to location 30 (refer xlcd.c for detail)
+			putnumXLCD(CurrentPosition[0],5);	// Displaying current position on LCD
+		}
+		if(!ShedTicks) ServiceCommand();	// Serial commands
 		for(y=0; y<50; y++);			// Time delay
 	}
 }//End of DelayAndPositionDisplay
 
+/********************************************************************
+*       Function Name:  IdleWait                                 	*
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine puts the CPU in idle mode for	*
+*						IDLE_WAIT control ticks. Peripherals and	*
+*						interrupts keep running, every interrupt	*
+*						wakes the CPU for a check: it returns at	*
+*						once when an axis wakes (encoder movement)	*
+*						or a serial command arrives.				*
+********************************************************************/
+void IdleWait(void)
+{
+	unsigned char Start;
+
+	OSCCONbits.IDLEN = 1;				// Sleep() stops the CPU only
+	Start = (unsigned char)ControlTick;		// Low byte, read in one access
+	while(((unsigned char)(ControlTick-Start)<IDLE_WAIT) && ControlIdle() && !DataRdySerial())
+	{
+		Sleep();						// Woken by the next interrupt
+	}
+}//End of IdleWait
+
+/********************************************************************
+*       Function Name:  Home                                     	*
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine seeks the home switch on INT2	*
+*						with axis 0 and waits until it is back at	*
+*						position 0. Without HOME_INPUT the power-up	*
+*						position stays position 0.					*
+********************************************************************/
+void Home(void)
+{
+#if HOME_INPUT
+	StartHome(0);
+	while(HomeState==HOME_SEEK) DelayAndPositionDisplay(1);
+	if(HomeState==HOME_FAILED)
+	{
+		SetCurXLCD(20);
+		putrsXLCD("Home failed     ");
+		while(1);						// Stay braked
+	}
+	DelayAndPositionDisplay(70);		// Settle at position 0
+#if BACKLASH_CALIBRATE
+	CalibrateBacklash();				// Measure the gearbox dead band
+#endif
+#endif
+}//End of Home
+
+/********************************************************************
+*       Function Name:  CalibrateBacklash                        	*
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine measures the gearbox backlash	*
+*						of axis 0 after homing. Position 0 is the	*
+*						home edge reached clockwise. The axis backs	*
+*						off clockwise and finds the edge again		*
+*						counter-clockwise: the extra motor travel	*
+*						to the edge is the dead band.				*
+********************************************************************/
+void CalibrateBacklash(void)
+{
+#if HOME_INPUT
+	SetPosition(0, -BACKLASH_CLEAR);	// Back off, still clockwise
+	DelayAndPositionDisplay(70);
+	StartProbe(0, -HOME_SPEED);			// Approach the edge counter-clockwise
+	while(HomeState==HOME_PROBE) DelayAndPositionDisplay(1);
+	if((HomeState==HOME_DONE)&&((signed int)ProbePosition>=0)&&((signed int)ProbePosition<=BACKLASH_MAX))
+	{
+		Backlash[0] = ProbePosition;
+	}
+	SetPosition(0, 0);					// Back to position 0, clockwise
+	DelayAndPositionDisplay(70);
+#endif
+}//End of CalibrateBacklash
+
+/********************************************************************
+*       Function Name:  ServiceCommand                             	*
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine runs the single character		*
+*						commands received on the serial port:		*
+*						'D' dumps the trace buffer					*
+*						'T' triggers the trace recorder				*
+*						'R' clears and re-arms the trace recorder	*
+*						'E' reports encoder errors and glitches		*
+*						'V' runs axis 0 at 60 RPM (velocity mode)	*
+*						'P' holds axis 0 where it is (position mode)*
+*						'B' reports the backlash of axis 0			*
+*						'I' reports current, limit and fault		*
+*						'C' clears the faults of every axis			*
+*						'O' reports tick overruns and cycle costs	*
+*						'M' reports the metrics of the present move	*
+*						'K' reports the stack use					*
+*						'X' reports the position compare triggers	*
+*						'Q' reports the gains and bus address		*
+*						'L' loads the EEPROM record and reports		*
+*						'A' starts the next 'G' on tick argument	*
+*						'G' moves every axis to the argument		*
+*						'Y' reports the tick and its phase error	*
+*						'W' writes byte argument&0xFF of the EEPROM	*
+*							record at offset argument>>8			*
+*						'N' adds trigger position argument			*
+*						'Z' clears the triggers, for axis argument	*
+*							('A', 'G', 'Y', 'W', 'N', 'Z':			*
+*							SERIAL_BUS only, refer serial.h)		*
+*						With SERIAL_BUS the output of a command is	*
+*						sent as the reply frame.					*
+********************************************************************/
+void ServiceCommand(void)
+{
+	unsigned char axis;
+	char Command;
+
+	Command = getcSerial();
+	if(!Command) return;
+	StartReply(Command);
+	switch(Command)
+	{
+		case 'D':
+			TraceDump();
+			break;
+		case 'T':
+			TraceTrigger();
+			break;
+		case 'R':
+			OpenTrace();
+			break;
+		case 'E':
+			EncoderReport();
+			break;
+		case 'V':
+			SetSpeed(0, RPM_TO_SPEED(60));
+			break;
+		case 'P':
+			HoldPosition(0);
+			break;
+		case 'B':
+			putrsSerial("BL ");
+			puthexSerial(Backlash[0]);
+			putrsSerial("\r\n");
+			break;
+#if CURRENT_SENSE
+		case 'I':
+			CurrentReport();
+			break;
+#endif
+		case 'C':
+			for(axis=0; axis<NUM_AXES; axis++) ClearFault(axis);
+			break;
+		case 'M':
+			MoveReport();
+			break;
+		case 'K':
+			StackReport();
+			break;
+		case 'X':
+			CompareReport();
+			break;
+		case 'Q':
+			ConfigReport();
+			break;
+		case 'L':
+			LoadConfig();
+			ConfigReport();
+			break;
+		case 'O':
+			putrsSerial("OVR ");
+			puthexSerial(Overruns);
+			putcSerial(' ');
+			puthexSerial(ControlCycles);
+			putcSerial(' ');
+			puthexSerial(CONTROL_BUDGET);
+			for(axis=0; axis<NUM_AXES; axis++)
+			{
+				putcSerial(' ');
+				puthexSerial(AxisCycles[axis]);	// Worst cycles of each axis step
+			}
+			putrsSerial("\r\n");
+			break;
+#if SERIAL_BUS
+		case 'A':
+			GoTick = SerialArg;			// Shared tick number (refer SyncControl)
+			GoAt = 1;
+			break;
+		case 'G':
+			if(!PIDEnable)
+			{
+				StartMotor();			// PWM takes over the motor pins
+				PIDEnable = AXIS_ALL;	// Power-up position is position 0
+			}
+			if(GoAt)
+			{
+				for(axis=0; axis<NUM_AXES; axis++) ScheduleMove(axis, SerialArg, GoTick);
+				GoAt = 0;
+			}
+			else MoveTo(SerialArg);
+			break;
+		case 'Y':
+			SyncReport();
+			break;
+		case 'W':
+			WriteConfig(SerialArg>>8, SerialArg&0xFF);	// Offset, byte (refer config.h)
+			break;
+		case 'N':
+			AddCompare(SerialArg);		// Refused if full or out of order, refer 'X'
+			break;
+		case 'Z':
+			if(SerialArg<NUM_AXES) ClearCompare(SerialArg);
+			break;
+#endif
+	}
+	EndReply();
+}//End of ServiceCommand
+
+/********************************************************************
+*       Function Name:  MoveTo                                    	*
+*       Return Value:   void                                        *
+*       Parameters:     position: desire position of every axis	*
+*       Description:    This routine sets the same desire position	*
+*						for all axes in position mode. Axes in		*
+*						velocity mode keep their speed.				*
+********************************************************************/
+void MoveTo(unsigned int position)
+{
+	unsigned char axis;
+	for(axis=0; axis<NUM_AXES; axis++)
+	{
+		if(AxisMode[axis]==MODE_POSITION) SetPosition(axis, position);
+	}
+}//End of MoveTo
+
 /********************************************************************
 *       Function Name:  Delay_1msX                               	*
 *       Return Value:   void                                        *
@@ -247,14 +534,13 @@ void InterruptVectorLow(void)
 //	this a function reserved for interrupt service routine
 //	User may need it in advance development of the program
 //=====================================================================================
-#pragma interrupt ISRHigh
+// Both levels save the math library scratch (MATH_DATA) and PROD: ControlUpdate(),
+// SyncControl() and the main line all use 32 bits multiply and divide
+#pragma interrupt ISRHigh save=section(".tmpdata"),section("MATH_DATA"),PROD
 void ISRHigh(void)
 {
-	signed int Output, Error0, ErrorDifferent;	
-	static signed int Error1, Error2, Error3, Sum_E;
-	
 	unsigned char State;	
-	static unsigned char PreviousState, EncoderUpdate;	
+	static unsigned char EncoderUpdate;	
 
 	if(INTCON3bits.INT1IF)			// If Channel A edge detected
 	{
@@ -273,94 +559,50 @@ void ISRHigh(void)
 	if(EncoderUpdate)				// Update position if encoder channel trigger the interrupt
 	{
 		State=(PORTCbits.RC4<<1)|PORTCbits.RC3;			// Read current state
-		switch(State)
-		{
-			case 0:										// If current state=0,0
-				if(PreviousState==1)CurrentPosition++;	// If previous state=0,1 , increase CurrentPosition 
-				else CurrentPosition--;					// If previous state=1,0 , decrease CurrentPosition 
-				break;
-			case 1:										// If current state=0,1
-				if(PreviousState==3)CurrentPosition++;	// If previous state=1,1 , increase CurrentPosition 
-				else CurrentPosition--;					// If previous state=0,0 , decrease CurrentPosition 
-				break;
-			case 2:										// If current state=1,0
-				if(PreviousState==0)CurrentPosition++;	// If previous state=0,0 , increase CurrentPosition 
-				else CurrentPosition--;					// If previous state=1,1 , decrease CurrentPosition 
-				break;
-			case 3:										// If current state=1,1
-				if(PreviousState==2)CurrentPosition++;	// If previous state=1,0 , increase CurrentPosition
-				else CurrentPosition--;					// If previous state=0,1 , decrease CurrentPosition 
-				break;
-		}	
-		PreviousState=State;		// Save the current state value for next state use
+		QuadDecode(0, State);		// Count up or down (refer encoder.c)
+		CompareCheck(0, EncoderCount[0]-HomeOffset[0], EncoderSince(0));	// Trigger output (refer compare.h)
 		EncoderUpdate=0;			// Clear encoder update flag
 	}
 	
-	if(PIR1bits.TMR1IF)				// Motor PID control (sample rate = 100Hz)
+#if HOME_INPUT
+	if(INTCON3bits.INT2IF)			// Home edge, latch the count now
 	{
-		TMR1H = 0x3C;				// Set timer 1 value for 100Hz (every 10ms) interrupt service routine
-		TMR1L = 0xAF;
+		INTCON3bits.INT2IF = 0;
+		HomeLatch(EncoderCount[0]);
+	}
+#endif
+	
+#if CURRENT_SENSE && (MOTOR_DRIVE == MOTOR_DRIVE_CCP2)
+	if(CurrentStartFlag)			// Start of a PWM period, before the tick can hold it off
+	{
+		CurrentStart();				// Clears the flag (refer current.c)
+	}
+#endif
+
+	if(PIE1bits.TMR1IE && PIR1bits.TMR1IF)	// Motor control tick, unless held off (refer control.c)
+	{
+		TMR1_RELOAD;				// Set timer 1 value for next control tick (100Hz or 400Hz, refer control.h)
 		PIR1bits.TMR1IF = 0;		// Clear interrupt flag		
 
-		Error0 = DesirePosition - CurrentPosition;			// Counting current error
-		
-		if(PIDEnable)				// Test for PID Enable
-		{
-			if(Error0>150)			// Motor run full speed if current position is too far from desire position
-			{
-				ccw;				// Counter-clockwise turn for positive error	
-				CCPR2L=255;			// Full speed
-				Sum_E=0;			// Clear summing error
-			}
-			else if(Error0<-150)	// Motor run full speed if current position is too far from desire position
-			{
-				cw;					// Clockwise turn for negative error
-				CCPR2L=255;			// Full speed
-				Sum_E=0;			// Clear summing error
-			}
-			else 					// Motor PID control when nearly to desire position
-			{			
-				// Integral term
-				Sum_E+=Error0;							// Summing error (Integral term)
-				if(Sum_E>240) Sum_E=240;				// Limit summing error
-				else if(Sum_E<-240) Sum_E=-240;			// Limit summing error
-				if((Error0>-2)&&(Error0<2)) Sum_E=0;	// Clear summing error to reduce the oscillation
-				
-				// Derivative term
-				ErrorDifferent = Error0 - Error3;					// Error different between current error and last third error 
-				
-				// PID output
-				Output = (Error0*4) + (Sum_E) + (ErrorDifferent*22);// Output = Proportional term + Integral term + Derivative term
-				
-				// Motor PID control
-				if(Output>1)
-				{
-					ccw;								// Counter-clockwise turn for positive error
-					if(Output>255) Output=255;			// Limit maximum output speed
-					else if(Output<140) Output=140;		// Mininum output for motor dead zone
-					CCPR2L=Output;						// Motor speed proportional to PID output
-				}
-				else if(Output<-1)
-				{
-					cw;									// Clockwise turn for negative error
-					Output=(-Output);					// Modulus for negative output
-					if(Output>255) Output=255;			// Limit maximum output speed
-					else if(Output<140) Output=140;		// Mininum output for motor dead zone
-					CCPR2L=Output;						// Motor speed proportional to PID output
-				}
-				else brake;								// Brake the motor if desire position reached
-				
-				// Previous errors saving for next Derivative term counting use 
-				Error3 = Error2;
-				Error2 = Error1;
-				Error1 = Error0;	
-			}	
-		}				
+		CurrentPosition[0] = EncoderCount[0] - HomeOffset[0];	// Position from the home reference
+		EncoderTick(0, CurrentPosition[0]);					// Interpolate from the edge times (refer encoder.c)
+
+		ControlUpdate();			// PID control (refer control.c)
+		ClrWdt();					// Tick completed, the watchdog resets the PIC if they stop
 	}
 }//End of ISRHigh
 
-#pragma interrupt ISRLow
+#pragma interruptlow ISRLow save=section(".tmpdata"),section("MATH_DATA"),PROD
 void ISRLow(void)
 {
-	
+	if(PIR1bits.RCIF)				// Serial byte received
+	{
+		SerialReceive();			// Reading RCREG clears the flag (refer serial.c)
+	}
+#if CURRENT_SENSE
+	if(CurrentFlag)					// Current conversion done
+	{
+		CurrentSample();			// Clears the flag (refer current.c)
+	}
+#endif
 }//End of ISRLow
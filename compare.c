@@ -0,0 +1,154 @@
+#include <p18f4431.h>
+#include "control.h"
+#include "compare.h"
+#include "serial.h"
+
+unsigned char CompareNext, CompareLength;
+unsigned int CompareTriggers;
+static unsigned int CompareList[COMPARE_MAX];
+static unsigned char CompareAxis;
+static signed char CompareDirection;
+static unsigned int LatencyLast, LatencyBest, LatencyWorst;
+
+
+/********************************************************************
+*       Function Name:  OpenCompare                                 *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine sets RC0 as the trigger output *
+*                       (low) and empties the list for axis 0.      *
+********************************************************************/
+void OpenCompare(void)
+{
+	CompareOutput = 0;
+	TRISCbits.TRISC0 = 0;		// Trigger output
+	CompareTriggers = 0;
+	LatencyLast = 0;
+	LatencyBest = 0xFFFF;
+	LatencyWorst = 0;
+	ClearCompare(0);
+}
+
+
+/********************************************************************
+*       Function Name:  ClearCompare                                *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*       Description:    This routine empties the list and selects   *
+*                       the axis it is checked against.             *
+********************************************************************/
+void ClearCompare(unsigned char axis)
+{
+	INTCONbits.GIEH = 0;		// CompareCheck() runs in ISRHigh
+	CompareNext = 0;
+	CompareLength = 0;
+	CompareAxis = axis;
+	CompareDirection = 1;
+	INTCONbits.GIEH = 1;
+}
+
+
+/********************************************************************
+*       Function Name:  AddCompare                                  *
+*       Return Value:   unsigned char: 0 if full or out of order    *
+*       Parameters:     Position: position of the next trigger      *
+*       Description:    This routine appends one trigger position.  *
+*                       The first sets the direction from the       *
+*                       present position, the next ones must carry  *
+*                       on in that direction.                       *
+********************************************************************/
+unsigned char AddCompare(unsigned int Position)
+{
+	unsigned char Added;
+	signed int Step;
+
+	Added = 0;
+	INTCONbits.GIEH = 0;
+	if(CompareLength<COMPARE_MAX)
+	{
+		if(CompareLength==0)
+		{
+			CompareNext = 0;
+			CompareDirection = ((signed int)(Position-CurrentPosition[CompareAxis])<0) ? -1 : 1;
+			Added = 1;
+		}
+		else
+		{
+			Step = Position-CompareList[CompareLength-1];
+			if((CompareDirection>0) ? (Step>=0) : (Step<=0)) Added = 1;
+		}
+		if(Added) CompareList[CompareLength++] = Position;
+	}
+	INTCONbits.GIEH = 1;
+	return Added;
+}
+
+
+/********************************************************************
+*       Function Name:  CompareCheck                                *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       Position: position after this count         *
+*                       Since: Timer 0/5 counts since the edge      *
+*       Description:    This routine toggles CompareOutput for      *
+*                       every list position the axis has reached    *
+*                       and keeps the latency. Call from ISRHigh on *
+*                       every count.                                *
+********************************************************************/
+void CompareCheck(unsigned char axis, unsigned int Position, unsigned int Since)
+{
+	while((axis==CompareAxis)&&(CompareNext<CompareLength))
+	{
+		if(CompareDirection>0)
+		{
+			if((signed int)(Position-CompareList[CompareNext])<0) return;
+		}
+		else if((signed int)(Position-CompareList[CompareNext])>0) return;
+
+		CompareOutput ^= 1;			// Trigger first, bookkeeping after
+		CompareNext++;
+		CompareTriggers++;
+		LatencyLast = Since;
+		if(Since<LatencyBest) LatencyBest = Since;
+		if(Since>LatencyWorst) LatencyWorst = Since;
+	}
+}
+
+
+/********************************************************************
+*       Function Name:  CompareReport                               *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine writes the compare state over  *
+*                       the EUSART in hex, do not call it from      *
+*                       interrupts: "CMP <next> <length>            *
+*                       <triggers> <last> <best> <worst>", latency  *
+*                       in 1.6us counts.                            *
+********************************************************************/
+void CompareReport(void)
+{
+	unsigned char Next, Length;
+	unsigned int Triggers, Last, Best, Worst;
+
+	INTCONbits.GIEH = 0;		// Consistent copy
+	Next = CompareNext;
+	Length = CompareLength;
+	Triggers = CompareTriggers;
+	Last = LatencyLast;
+	Best = LatencyBest;
+	Worst = LatencyWorst;
+	INTCONbits.GIEH = 1;
+	putrsSerial("CMP ");
+	puthexSerial(Next);
+	putcSerial(' ');
+	puthexSerial(Length);
+	putcSerial(' ');
+	puthexSerial(Triggers);
+	putcSerial(' ');
+	puthexSerial(Last);
+	putcSerial(' ');
+	puthexSerial(Best);
+	putcSerial(' ');
+	puthexSerial(Worst);
+	putrsSerial("\r\n");
+}
@@ -0,0 +1,69 @@
+#ifndef __COMPARE_H
+#define __COMPARE_H
+
+/* Position compare trigger output.
+ *
+ *   Notes:
+ *		- AddCompare() appends positions of one axis to a list of
+ *		  up to COMPARE_MAX, in the order the axis passes them:
+ *		  rising for a counter-clockwise move, falling for a
+ *		  clockwise one. The direction is taken from the first
+ *		  position against the present position of the axis, a
+ *		  position out of order is refused.
+ *		- CompareOutput (RC0) toggles each time the axis reaches
+ *		  the next position of the list, so a camera or valve
+ *		  input sees an edge per position. The list is done when
+ *		  CompareNext reaches CompareLength, ClearCompare() empties
+ *		  it and selects the axis of the next list.
+ *		- The user calls CompareCheck() from ISRHigh on every
+ *		  count of the axis:
+ *          - Software decoder: after QuadDecode(), with
+ *            EncoderSince() as the time since the edge.
+ *          - QEI: on the IC1 interrupt, which the velocity capture
+ *            raises on every count, with TMR5 as the time since
+ *            the edge (Timer 5 restarts on each count).
+ *		  The output therefore changes on the count itself. The
+ *		  latency is the time from the edge to the check, in
+ *		  Timer 0/5 counts (1.6us): it is mostly the wait for a
+ *		  control tick in progress (ISRHigh, up to ControlCycles).
+ *		  The QEI measures it from the hardware edge, the
+ *		  software decoder from the start of QuadDecode(), so
+ *		  its interrupt entry is not included. CompareReport()
+ *		  writes the last, shortest and longest latency, their
+ *		  difference is the jitter.
+ */
+
+#define COMPARE_MAX			8			/* Positions in the list */
+
+#define CompareOutput		LATCbits.LATC0
+
+extern unsigned char CompareNext, CompareLength;
+extern unsigned int CompareTriggers;			/* Outputs toggled since reset */
+
+
+/* OpenCompare
+ * Sets RC0 as the trigger output and empties the list
+ */
+void OpenCompare(void);
+
+/* ClearCompare
+ * Empties the list and selects the axis of the next positions
+ */
+void ClearCompare(unsigned char axis);
+
+/* AddCompare
+ * Appends one position to the list, returns 0 if full or out of order
+ */
+unsigned char AddCompare(unsigned int Position);
+
+/* CompareCheck
+ * Toggles the output when the axis reaches the next position, call from ISRHigh
+ */
+void CompareCheck(unsigned char axis, unsigned int Position, unsigned int Since);
+
+/* CompareReport
+ * Writes the list state and the trigger latency over the EUSART
+ */
+void CompareReport(void);
+
+#endif
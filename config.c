@@ -0,0 +1,189 @@
+#include <p18f4431.h>
+#include "control.h"
+#include "serial.h"
+#include "config.h"
+
+unsigned char ConfigState;
+
+
+/********************************************************************
+*       Function Name:  ReadEeprom                                  *
+*       Return Value:   unsigned char: data                         *
+*       Parameters:     Address: EEPROM address                     *
+*       Description:    This routine reads one data EEPROM byte.    *
+********************************************************************/
+static unsigned char ReadEeprom(unsigned char Address)
+{
+	EEADR = Address;
+	EECON1bits.EEPGD = 0;		// Data EEPROM
+	EECON1bits.CFGS = 0;
+	EECON1bits.RD = 1;
+	return EEDATA;
+}
+
+
+/********************************************************************
+*       Function Name:  WriteEeprom                                 *
+*       Return Value:   void                                        *
+*       Parameters:     Address: EEPROM address                     *
+*                       Data: byte to be written                    *
+*       Description:    This routine writes one data EEPROM byte    *
+*                       and waits for the end of the write (4ms).   *
+*                       Interrupts are held off for the unlock      *
+*                       sequence only.                              *
+********************************************************************/
+static void WriteEeprom(unsigned char Address, unsigned char Data)
+{
+	EEADR = Address;
+	EEDATA = Data;
+	EECON1bits.EEPGD = 0;		// Data EEPROM
+	EECON1bits.CFGS = 0;
+	EECON1bits.WREN = 1;
+	INTCONbits.GIEH = 0;		// Every interrupt off (IPEN set)
+	EECON2 = 0x55;				// Unlock sequence
+	EECON2 = 0xAA;
+	EECON1bits.WR = 1;
+	INTCONbits.GIEH = 1;
+	while(EECON1bits.WR);		// Cleared at the end of the write
+	EECON1bits.WREN = 0;
+}
+
+
+/********************************************************************
+*       Function Name:  CheckConfig                                 *
+*       Return Value:   unsigned char: non zero if usable           *
+*       Parameters:     Record: record read from the EEPROM         *
+*       Description:    This routine checks what PositionPID()      *
+*                       relies on: the first band at error 0, band  *
+*                       errors strictly rising (no zero width band  *
+*                       to divide by), Kp, Ki and Kd small enough   *
+*                       for their terms to fit a signed int, ISum   *
+*                       within the Q4 integral and a dead zone      *
+*                       below full output. PositionPID() saturates  *
+*                       the sum of the terms.                       *
+********************************************************************/
+static unsigned char CheckConfig(CONFIG_RECORD *Record)
+{
+	unsigned char i;
+
+	if(Record->Gains[0].Error!=0) return 0;
+	for(i=0; i<GAIN_BANDS; i++)
+	{
+		if(Record->Gains[i].Kp>CONFIG_KP_MAX) return 0;
+		if(Record->Gains[i].Ki>CONFIG_KI_MAX) return 0;
+		if(Record->Gains[i].Kd>CONFIG_KD_MAX) return 0;
+		if((i>0)&&(Record->Gains[i].Error<=Record->Gains[i-1].Error)) return 0;
+	}
+	if(Record->ISum>CONFIG_ISUM_MAX) return 0;
+	if(Record->DeadZone>=255) return 0;
+	return 1;
+}
+
+
+/********************************************************************
+*       Function Name:  OpenConfig                                  *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine loads the record, or keeps the *
+*                       defaults if it is not valid.                *
+********************************************************************/
+void OpenConfig(void)
+{
+	if(!LoadConfig()) ConfigState = CONFIG_DEFAULT;	// Blank or damaged, the defaults stay
+}
+
+
+/********************************************************************
+*       Function Name:  LoadConfig                                  *
+*       Return Value:   unsigned char: non zero if valid            *
+*       Parameters:     void                                        *
+*       Description:    This routine reads the record, checks its   *
+*                       size, CRC, node address and contents and    *
+*                       puts it in use. An invalid record is not    *
+*                       used.                                       *
+********************************************************************/
+unsigned char LoadConfig(void)
+{
+	CONFIG_RECORD Record;
+	unsigned char *p;
+	unsigned char i, crc;
+
+	p = (unsigned char *)&Record;
+	crc = 0;
+	for(i=0; i<sizeof(CONFIG_RECORD); i++)
+	{
+		p[i] = ReadEeprom(CONFIG_ADDRESS+i);
+		if(i<sizeof(CONFIG_RECORD)-1) crc = Crc8(crc, p[i]);
+	}
+	if((Record.Size!=sizeof(CONFIG_RECORD))||(Record.Crc!=crc)||(Record.Node==SERIAL_BROADCAST)||!CheckConfig(&Record))
+	{
+		ConfigState = CONFIG_INVALID;
+		return 0;
+	}
+
+	SetGains(Record.Gains, Record.ISum, Record.DeadZone);
+#if SERIAL_BUS
+	NodeAddress = Record.Node;
+#endif
+	ConfigState = CONFIG_LOADED;
+	return 1;
+}
+
+
+/********************************************************************
+*       Function Name:  WriteConfig                                 *
+*       Return Value:   void                                        *
+*       Parameters:     Offset: byte of the record                  *
+*                       Data: byte to be written                    *
+*       Description:    This routine writes one byte of the record. *
+*                       The settings in use do not change until     *
+*                       LoadConfig(). Offsets past the record are   *
+*                       ignored.                                    *
+********************************************************************/
+void WriteConfig(unsigned char Offset, unsigned char Data)
+{
+	if(Offset<sizeof(CONFIG_RECORD)) WriteEeprom(CONFIG_ADDRESS+Offset, Data);
+}
+
+
+/********************************************************************
+*       Function Name:  ConfigReport                                *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine writes the settings in use     *
+*                       over the EUSART in hex, do not call it from *
+*                       interrupts: "CFG <state> <node>", one line  *
+*                       "GAIN <error> <kp> <ki> <kd>" per band and  *
+*                       "ISUM <limit> <dead zone>".                 *
+********************************************************************/
+void ConfigReport(void)
+{
+	unsigned char i;
+
+	putrsSerial("CFG ");
+	puthexSerial(ConfigState);
+	putcSerial(' ');
+#if SERIAL_BUS
+	puthexSerial(NodeAddress);
+#else
+	puthexSerial(NODE_ID);
+#endif
+	putrsSerial("\r\n");
+	for(i=0; i<GAIN_BANDS; i++)
+	{
+		putrsSerial("GAIN ");
+		puthexSerial(GainTable[i].Error);
+		putcSerial(' ');
+		puthexSerial(GainTable[i].Kp);
+		putcSerial(' ');
+		puthexSerial(GainTable[i].Ki);
+		putcSerial(' ');
+		puthexSerial(GainTable[i].Kd);
+		putrsSerial("\r\n");
+	}
+	putrsSerial("ISUM ");
+	puthexSerial(GainISum);
+	putcSerial(' ');
+	puthexSerial(DeadZoneOutput);
+	putrsSerial("\r\n");
+}
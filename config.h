@@ -0,0 +1,79 @@
+#ifndef __CONFIG_H
+#define __CONFIG_H
+
+/* Controller configuration record in the data EEPROM.
+ *
+ *   Notes:
+ *		- The record holds the position PID gain schedule, its
+ *		  integral limit and the motor dead zone (refer
+ *		  SetGains() in control.h) and the bus address of the
+ *		  node (refer serial.h). It sits at CONFIG_ADDRESS,
+ *		  integers low byte first:
+ *          - Size: sizeof(CONFIG_RECORD), 38. A blank EEPROM
+ *            reads 0xFF.
+ *          - Gains: GAIN_BANDS rows of Error, Kp, Ki, Kd (Q4).
+ *            The first Error is 0 and each next one is larger,
+ *            Kp, Ki and Kd are at most CONFIG_KP_MAX,
+ *            CONFIG_KI_MAX and CONFIG_KD_MAX.
+ *          - ISum: integral limit (Q4), at most CONFIG_ISUM_MAX.
+ *          - DeadZone: least output that turns the motor, below
+ *            255.
+ *          - Node: bus address, 01-FF.
+ *          - Crc: CRC-8 (polynomial 0x07, start 0) of the bytes
+ *            before it.
+ *		- OpenConfig() loads the record at start-up. Without a
+ *		  valid one (size, CRC, address and the limits above) the
+ *		  defaults of control.h and serial.h stay.
+ *		  LoadConfig() loads it again, an invalid record leaves
+ *		  the present settings in use.
+ *		- A record made off-line (e.g. from a gain search on a
+ *		  plant model) is written a byte at a time over the bus
+ *		  with WriteConfig(), CRC included, then loaded. A write
+ *		  takes about 4ms, the control tick keeps running.
+ *		- ConfigReport() writes the settings in use.
+ */
+
+#define CONFIG_ADDRESS		0x00		/* EEPROM address of the record */
+#define CONFIG_KP_MAX		524			/* Largest Kp (Q4), 1000*Kp/16 fits a signed int */
+#define CONFIG_KI_MAX		524			/* Largest Ki (Q4), one tick of a 1000 count error fits */
+#define CONFIG_KD_MAX		2048		/* Largest Kd (Q4), GAIN_DIFF_MAX*Kd/256 fits a signed int */
+#define CONFIG_ISUM_MAX		0x7FFF		/* Largest integral limit, Sum_E[] is a signed int */
+
+#define CONFIG_DEFAULT		0			/* ConfigState: no valid record, defaults in use */
+#define CONFIG_LOADED		1			/* ConfigState: record in use */
+#define CONFIG_INVALID		2			/* ConfigState: last load failed, settings kept */
+
+typedef struct
+{
+	unsigned char Size;
+	GAIN_BAND Gains[GAIN_BANDS];
+	unsigned int ISum;
+	unsigned char DeadZone;
+	unsigned char Node;
+	unsigned char Crc;
+} CONFIG_RECORD;
+
+extern unsigned char ConfigState;
+
+
+/* OpenConfig
+ * Loads the record at start-up, call after OpenControl() and OpenSerial()
+ */
+void OpenConfig(void);
+
+/* LoadConfig
+ * Reads and checks the record and puts it in use, returns non zero if valid
+ */
+unsigned char LoadConfig(void);
+
+/* WriteConfig
+ * Writes one byte of the record to the EEPROM, Offset from the start
+ */
+void WriteConfig(unsigned char Offset, unsigned char Data);
+
+/* ConfigReport
+ * Writes the settings in use over the EUSART
+ */
+void ConfigReport(void);
+
+#endif
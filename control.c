@@ -0,0 +1,981 @@
+#include <p18f4431.h>
+#include "control.h"
+#include "motor.h"
+#include "encoder.h"
+#include "current.h"
+#include "trace.h"
+#include "serial.h"
+
+unsigned char PIDEnable=0;
+unsigned int CurrentPosition[NUM_AXES], DesirePosition[NUM_AXES];
+unsigned char AxisMode[NUM_AXES], AxisFault[NUM_AXES];
+signed int TargetSpeed[NUM_AXES], MeasuredSpeed[NUM_AXES];
+unsigned int ControlCycles, AxisCycles[NUM_AXES];
+unsigned int Overruns, ShedTicks;
+unsigned char IdleAxes;
+unsigned int ControlTick, TickReload;
+signed int SyncError;
+unsigned int Syncs;
+MOVE_METRICS MoveMetrics[NUM_AXES];
+unsigned int HomeOffset[NUM_AXES];
+unsigned char HomeAxis, HomeState;
+unsigned int ProbePosition;
+unsigned char Backlash[NUM_AXES];
+static unsigned int HomeTicks;
+static signed int HomeSpeed;
+static unsigned char BacklashOffset[NUM_AXES];
+static unsigned int IdleTicks[NUM_AXES];
+static unsigned char IdleHold[NUM_AXES];
+static unsigned int PeriodReload;
+static signed int PhaseTrim;
+static unsigned int StartTick[NUM_AXES], StartPosition[NUM_AXES];
+static unsigned char StartAxes;
+
+GAIN_BAND GainTable[GAIN_BANDS];
+unsigned int GainISum;
+unsigned char DeadZoneOutput;
+
+/* Gain schedule until SetGains() (refer config.h) */
+static const rom GAIN_BAND GainDefault[GAIN_BANDS] =
+{
+	{   0, 64, 16, 352 },	// Kp 4, Ki 1, Kd 22: the tutorial PID
+	{ 100, 64, 16, 352 },
+	{ 150, 48,  0, 288 },	// Integral off, output leaves saturation
+	{ 400, 32,  0, 192 }	// Full speed beyond, derivative brakes early
+};
+
+#if !CONTROL_CASCADE
+
+#define GAIN_RESET			0xFE	/* GainBand: no band yet, integral starts at 0 */
+#define GAIN_PRELOAD		0xFF	/* GainBand: no band yet, integral takes the last output */
+
+static signed int Error1[NUM_AXES], Error2[NUM_AXES], Error3[NUM_AXES], Sum_E[NUM_AXES];
+static unsigned char GainBand[NUM_AXES];
+#else
+static signed int FeedVelocity[NUM_AXES];
+static unsigned int LastDesire[NUM_AXES];
+#endif
+static signed int VelocityCommand[NUM_AXES], VelocitySum[NUM_AXES], FeedAccel[NUM_AXES];
+static signed int LastOutput[NUM_AXES];
+static unsigned char OuterCount, OverrunRun;
+static unsigned int WatchTarget, WatchError;
+static unsigned char WatchTicks;
+
+
+/********************************************************************
+*       Function Name:  ReadTimer1                                  *
+*       Return Value:   unsigned int: Timer 1 count                 *
+*       Parameters:     void                                        *
+*       Description:    This routine reads the 16 bits Timer 1      *
+*                       count. T1CON.RD16 must be set so that the   *
+*                       high byte is latched when TMR1L is read.    *
+********************************************************************/
+static unsigned int ReadTimer1(void)
+{
+	unsigned int Count;
+	Count = TMR1L;
+	Count |= (unsigned int)TMR1H<<8;
+	return Count;
+}
+
+
+/********************************************************************
+*       Function Name:  ResetAxis                                   *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*       Description:    This routine clears the controller history  *
+*                       of one axis.                                *
+********************************************************************/
+static void ResetAxis(unsigned char axis)
+{
+#if !CONTROL_CASCADE
+	Error1[axis] = Error2[axis] = Error3[axis] = 0;
+	Sum_E[axis] = 0;
+	GainBand[axis] = GAIN_RESET;
+#else
+	FeedVelocity[axis] = 0;
+	LastDesire[axis] = DesirePosition[axis];
+#endif
+	VelocityCommand[axis] = VelocitySum[axis] = FeedAccel[axis] = 0;
+	LastOutput[axis] = 0;
+	MeasuredSpeed[axis] = 0;
+	IdleAxes &= ~(1<<axis);
+	IdleTicks[axis] = 0;
+}
+
+
+/********************************************************************
+*       Function Name:  StartMetrics                                *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*       Description:    This routine clears the move metrics of one *
+*                       axis for a new move.                        *
+********************************************************************/
+static void StartMetrics(unsigned char axis)
+{
+	MoveMetrics[axis].Duty = 0;
+	MoveMetrics[axis].Ticks = 0;
+	MoveMetrics[axis].Saturated = 0;
+	MoveMetrics[axis].Settle = 0;
+	MoveMetrics[axis].Reversals = 0;
+}
+
+
+#if !CONTROL_CASCADE
+/********************************************************************
+*       Function Name:  ErrorQ4                                     *
+*       Return Value:   signed int: position error in Q4            *
+*       Parameters:     axis: axis number                           *
+*                       Position: target position                   *
+*       Description:    This routine gives the interpolated error   *
+*                       to Position for the derivative term. The    *
+*                       count error is clamped to +-1000 first, so  *
+*                       the Q4 error (up to +-16015) cannot wrap.   *
+********************************************************************/
+static signed int ErrorQ4(unsigned char axis, unsigned int Position)
+{
+	signed int Error;
+
+	Error = Position + BacklashOffset[axis] - CurrentPosition[axis];
+	if(Error>1000) Error=1000;
+	else if(Error<-1000) Error=-1000;
+	return (Error<<4) - (signed int)(FinePosition[axis] - (CurrentPosition[axis]<<4));	// Less the fraction past the count
+}
+#endif
+
+
+/********************************************************************
+*       Function Name:  OpenControl                                 *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine clears the state of every      *
+*                       axis. C18 does not clear uninitialised      *
+*                       variables at start-up. Call it before the   *
+*                       Timer 1 interrupt is enabled.               *
+********************************************************************/
+void OpenControl(void)
+{
+	unsigned char axis;
+
+	PIDEnable = 0;
+	IdleAxes = 0;
+	ControlTick = 0;
+	TickReload = CONTROL_RELOAD;
+	PeriodReload = CONTROL_RELOAD;
+	PhaseTrim = 0;
+	SyncError = 0;
+	Syncs = 0;
+	StartAxes = 0;
+	for(axis=0; axis<GAIN_BANDS; axis++) GainTable[axis] = GainDefault[axis];
+	GainISum = GAIN_ISUM;
+	DeadZoneOutput = DEAD_ZONE;
+	ControlCycles = 0;
+	Overruns = 0;
+	ShedTicks = 0;
+	OverrunRun = 0;
+	HomeState = HOME_IDLE;
+	for(axis=0; axis<NUM_AXES; axis++)
+	{
+		CurrentPosition[axis] = 0;
+		DesirePosition[axis] = 0;
+		AxisMode[axis] = MODE_POSITION;
+		AxisFault[axis] = FAULT_NONE;
+		TargetSpeed[axis] = 0;
+		HomeOffset[axis] = 0;
+		Backlash[axis] = BACKLASH_COUNTS;
+		BacklashOffset[axis] = 0;
+		IdleHold[axis] = MOTOR_HOLD_COAST;
+		AxisCycles[axis] = 0;
+		StartMetrics(axis);
+		ResetAxis(axis);
+	}
+}
+
+
+/********************************************************************
+*       Function Name:  SetPosition                                 *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       Position: desire position                   *
+*       Description:    This routine sets the target position. An   *
+*                       axis in velocity mode is switched over with *
+*                       the position controller preloaded: no       *
+*                       derivative kick, and the integral (or the   *
+*                       cascade velocity loop) carries the output.  *
+*                       A counter-clockwise move also takes up the  *
+*                       gearbox backlash, a clockwise move drops    *
+*                       it, so the output shaft reaches Position    *
+*                       from either side.                           *
+********************************************************************/
+void SetPosition(unsigned char axis, unsigned int Position)
+{
+	signed int Move;
+#if !CONTROL_CASCADE
+	signed int Error0;
+#endif
+
+	PIE1bits.TMR1IE = 0;			// Hold off the control tick
+	Move = Position - DesirePosition[axis];
+	if(AxisMode[axis]!=MODE_POSITION) Move = Position - CurrentPosition[axis];
+	if(Move>0) BacklashOffset[axis] = Backlash[axis];	// Counter-clockwise approach
+	else if(Move<0) BacklashOffset[axis] = 0;			// Clockwise approach, the reference side
+	if(Move!=0)
+	{
+		IdleHold[axis] = MOTOR_HOLD_COAST;				// New place, start with the least hold again
+		StartMetrics(axis);
+	}
+	IdleAxes &= ~(1<<axis);
+	IdleTicks[axis] = 0;
+	if(AxisMode[axis]!=MODE_POSITION)
+	{
+#if !CONTROL_CASCADE
+		Error0 = ErrorQ4(axis, Position);
+		Error1[axis] = Error2[axis] = Error3[axis] = Error0;	// No derivative kick
+		GainBand[axis] = GAIN_PRELOAD;							// Integral gives the rest of the last output
+#else
+		LastDesire[axis] = Position;		// No setpoint step fed forward
+		FeedVelocity[axis] = 0;
+		FeedAccel[axis] = 0;				// Velocity command and integral carry over
+#endif
+		AxisMode[axis] = MODE_POSITION;
+	}
+	DesirePosition[axis] = Position;
+	PIE1bits.TMR1IE = 1;
+}
+
+
+/********************************************************************
+*       Function Name:  HoldPosition                                *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*       Description:    This routine switches an axis to position   *
+*                       mode with its present position as target.   *
+********************************************************************/
+void HoldPosition(unsigned char axis)
+{
+	unsigned int Position;
+
+	PIE1bits.TMR1IE = 0;
+	Position = CurrentPosition[axis];
+	PIE1bits.TMR1IE = 1;
+	SetPosition(axis, Position);
+}
+
+
+/********************************************************************
+*       Function Name:  SetSpeed                                    *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       Speed: counts per 10ms in Q4 (RPM_TO_SPEED) *
+*       Description:    This routine sets the target speed. An axis *
+*                       in position mode is switched over with the  *
+*                       ramp starting at the measured speed and the *
+*                       integral preloaded to the last output.      *
+********************************************************************/
+void SetSpeed(unsigned char axis, signed int Speed)
+{
+	signed long Sum;
+
+	if(Speed>VELOCITY_MAX) Speed=VELOCITY_MAX;
+	else if(Speed<-VELOCITY_MAX) Speed=-VELOCITY_MAX;
+
+	PIE1bits.TMR1IE = 0;			// Hold off the control tick
+	if((AxisMode[axis]!=MODE_VELOCITY)||(Speed!=TargetSpeed[axis])) StartMetrics(axis);
+	if(AxisMode[axis]!=MODE_VELOCITY)
+	{
+		VelocityCommand[axis] = MeasuredSpeed[axis];	// Ramp from the present speed
+		FeedAccel[axis] = 0;
+		Sum = ((signed long)LastOutput[axis]*16 - (signed long)VelocityCommand[axis]*VELOCITY_KFF)/VELOCITY_KI;
+		if(Sum>VELOCITY_ISUM) Sum=VELOCITY_ISUM;
+		else if(Sum<-VELOCITY_ISUM) Sum=-VELOCITY_ISUM;
+		VelocitySum[axis] = (signed int)Sum;
+		AxisMode[axis] = MODE_VELOCITY;
+	}
+	TargetSpeed[axis] = Speed;
+	IdleAxes &= ~(1<<axis);
+	PIE1bits.TMR1IE = 1;
+}
+
+
+/********************************************************************
+*       Function Name:  SetGains                                    *
+*       Return Value:   void                                        *
+*       Parameters:     Gains: GAIN_BANDS rows of the schedule      *
+*                       ISum: integral limit, Q4                    *
+*                       DeadZone: least output that turns the motor *
+*       Description:    This routine replaces the position PID      *
+*                       gains between two ticks. The integral of    *
+*                       each axis is preloaded from the last output *
+*                       on the next tick, so the output carries on. *
+********************************************************************/
+void SetGains(GAIN_BAND *Gains, unsigned int ISum, unsigned char DeadZone)
+{
+	unsigned char i;
+
+	PIE1bits.TMR1IE = 0;			// Hold off the control tick
+	for(i=0; i<GAIN_BANDS; i++) GainTable[i] = Gains[i];
+	GainISum = ISum;
+	DeadZoneOutput = DeadZone;
+#if !CONTROL_CASCADE
+	for(i=0; i<NUM_AXES; i++) if(GainBand[i]!=GAIN_RESET) GainBand[i] = GAIN_PRELOAD;
+#endif
+	PIE1bits.TMR1IE = 1;
+}
+
+
+/********************************************************************
+*       Function Name:  ClearFault                                  *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*       Description:    This routine clears a latched fault. The    *
+*                       axis restarts in position mode, holding the *
+*                       position where it stopped.                  *
+********************************************************************/
+void ClearFault(unsigned char axis)
+{
+	PIE1bits.TMR1IE = 0;			// Hold off the control tick
+	DesirePosition[axis] = CurrentPosition[axis];
+	AxisMode[axis] = MODE_POSITION;
+	ResetAxis(axis);
+	AxisFault[axis] = FAULT_NONE;
+	PIE1bits.TMR1IE = 1;
+}
+
+
+/********************************************************************
+*       Function Name:  StartHome                                   *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*       Description:    This routine arms the INT2 home input and   *
+*                       starts driving the axis at HOME_SPEED.      *
+*                       The PID of the axis must be enabled.        *
+********************************************************************/
+void StartHome(unsigned char axis)
+{
+	HomeAxis = axis;
+	HomeTicks = 0;
+	HomeSpeed = HOME_SPEED;
+	INTCON2bits.INTEDG2 = HOME_EDGE;
+	INTCON3bits.INT2IP = 1;			// Latch in the high priority interrupt
+	INTCON3bits.INT2IF = 0;
+	HomeState = HOME_SEEK;
+	INTCON3bits.INT2IE = 1;
+}
+
+
+/********************************************************************
+*       Function Name:  StartProbe                                  *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       Speed: -255 to 255, sign gives direction    *
+*       Description:    This routine arms the INT2 home input like  *
+*                       StartHome() but keeps the reference: the    *
+*                       position at the edge goes to ProbePosition  *
+*                       and the axis holds there. Against the seek  *
+*                       direction the flag is left, not entered, so *
+*                       the opposite transition is armed.           *
+********************************************************************/
+void StartProbe(unsigned char axis, signed int Speed)
+{
+	HomeAxis = axis;
+	HomeTicks = 0;
+	HomeSpeed = Speed;
+	if((Speed<0)==(HOME_SPEED<0)) INTCON2bits.INTEDG2 = HOME_EDGE;
+	else INTCON2bits.INTEDG2 = !HOME_EDGE;	// Same flag edge from the other side
+	INTCON3bits.INT2IP = 1;
+	INTCON3bits.INT2IF = 0;
+	HomeState = HOME_PROBE;
+	INTCON3bits.INT2IE = 1;
+}
+
+
+/********************************************************************
+*       Function Name:  HomeLatch                                   *
+*       Return Value:   void                                        *
+*       Parameters:     Count: raw count of the homing axis read    *
+*                       in the same interrupt as the home edge      *
+*       Description:    This routine makes the count at the edge    *
+*                       position 0 and sends the axis back to it.   *
+*                       After StartProbe() it only records the      *
+*                       position at the edge.                       *
+********************************************************************/
+void HomeLatch(unsigned int Count)
+{
+	INTCON3bits.INT2IE = 0;
+	if(HomeState==HOME_PROBE)
+	{
+		ProbePosition = Count - HomeOffset[HomeAxis];
+		DesirePosition[HomeAxis] = ProbePosition;
+		ResetAxis(HomeAxis);
+		HomeState = HOME_DONE;
+		return;
+	}
+	if(HomeState!=HOME_SEEK) return;
+	CurrentPosition[HomeAxis] += HomeOffset[HomeAxis] - Count;	// New reference until the next tick samples it
+	HomeOffset[HomeAxis] = Count;
+	DesirePosition[HomeAxis] = 0;
+	BacklashOffset[HomeAxis] = 0;	// Edge reached clockwise, the reference side
+	ResetAxis(HomeAxis);
+	HomeState = HOME_DONE;
+}
+
+
+/********************************************************************
+*       Function Name:  DeadZone                                    *
+*       Return Value:   signed int: motor speed, -255 to 255        *
+*       Parameters:     Output: controller output                   *
+*       Description:    This routine limits the output to full      *
+*                       speed and lifts small outputs above the     *
+*                       motor dead zone. Outputs of -1 to 1 brake.  *
+********************************************************************/
+static signed int DeadZone(signed int Output)
+{
+	if(Output>1)
+	{
+		if(Output>255) Output=255;			// Limit maximum output speed
+		else if(Output<(signed int)DeadZoneOutput) Output=DeadZoneOutput;		// Mininum output for motor dead zone
+	}
+	else if(Output<-1)
+	{
+		if(Output<-255) Output=-255;		// Limit maximum output speed
+		else if(Output>-(signed int)DeadZoneOutput) Output=-(signed int)DeadZoneOutput;	// Mininum output for motor dead zone
+	}
+	else Output=0;							// Brake the motor if desire position reached
+	return Output;
+}
+
+
+#if !CONTROL_CASCADE
+/********************************************************************
+*       Function Name:  Interpolate                                 *
+*       Return Value:   unsigned int: gain between Low and High     *
+*       Parameters:     Low, High: gains at the band edges          *
+*                       Ratio: position in the band, 0-256          *
+*       Description:    This routine interpolates a scheduled gain. *
+********************************************************************/
+static unsigned int Interpolate(unsigned int Low, unsigned int High, unsigned int Ratio)
+{
+	return Low + (signed int)(((signed long)(signed int)(High-Low)*Ratio)>>8);
+}
+
+
+/********************************************************************
+*       Function Name:  PositionPID                                 *
+*       Return Value:   signed int: motor speed, -255 to 255        *
+*       Parameters:     axis: axis number                           *
+*       Description:    This routine runs the position PID of one   *
+*                       axis with the gains scheduled on the size   *
+*                       of the error (refer GainTable). On a band   *
+*                       change the integral is preloaded with the   *
+*                       last output less the new P and D terms,     *
+*                       unless that output was saturated. The       *
+*                       derivative term works on the interpolated   *
+*                       position (Q4), so it acts below one count   *
+*                       per tick.                                   *
+********************************************************************/
+static signed int PositionPID(unsigned char axis)
+{
+	signed int Output, Error0, FineError, ErrorDifferent, Proportional, Derivative;
+	unsigned int Magnitude, Ratio, Kp, Ki, Kd;
+	unsigned char Band, Row;
+	signed long Sum;
+
+	Error0 = DesirePosition[axis] + BacklashOffset[axis] - CurrentPosition[axis];	// Counting current error
+	if(Error0>1000) Error0=1000;								// Output is saturated long before
+	else if(Error0<-1000) Error0=-1000;
+	FineError = ErrorQ4(axis, DesirePosition[axis]);			// Same error in Q4, from the clamped one
+
+	// Scheduled gains
+	Magnitude = (Error0<0) ? -Error0 : Error0;
+	for(Band=0; (Band<GAIN_BANDS-1)&&(Magnitude>=GainTable[Band+1].Error); Band++);
+	Row = (Band<GAIN_BANDS-1) ? Band : GAIN_BANDS-2;				// Interpolate between Row and Row+1
+	if(Magnitude>=GainTable[Row+1].Error) Ratio = 256;
+	else Ratio = ((unsigned long)(Magnitude-GainTable[Row].Error)<<8)/(GainTable[Row+1].Error-GainTable[Row].Error);
+	Kp = Interpolate(GainTable[Row].Kp, GainTable[Row+1].Kp, Ratio);
+	Ki = Interpolate(GainTable[Row].Ki, GainTable[Row+1].Ki, Ratio);
+	Kd = Interpolate(GainTable[Row].Kd, GainTable[Row+1].Kd, Ratio);
+
+	// Proportional and derivative terms
+	ErrorDifferent = FineError - Error3[axis];					// Error different between current error and last third error, Q4
+	if(ErrorDifferent>GAIN_DIFF_MAX) ErrorDifferent=GAIN_DIFF_MAX;	// Keep ErrorDifferent*Kd in range
+	else if(ErrorDifferent<-GAIN_DIFF_MAX) ErrorDifferent=-GAIN_DIFF_MAX;
+	Proportional = (signed int)(((signed long)Error0*Kp)>>4);
+	Derivative = (signed int)(((signed long)ErrorDifferent*Kd)>>8);
+
+	// Integral term
+	if(Band!=GainBand[axis])									// Band change, carry on from the last output
+	{
+		if((GainBand[axis]!=GAIN_RESET)&&(LastOutput[axis]>-255)&&(LastOutput[axis]<255))
+			Sum = ((signed long)LastOutput[axis] - Proportional - Derivative)<<4;
+		else Sum = 0;
+		if(Sum>(signed long)GainISum) Sum=GainISum;
+		else if(Sum<-(signed long)GainISum) Sum=-(signed long)GainISum;
+		Sum_E[axis] = (signed int)Sum;
+		GainBand[axis] = Band;
+	}
+	if(Ki==0) Sum_E[axis]=0;									// No integral far from the target
+	else
+	{
+		Sum = Sum_E[axis] + (signed long)Error0*Ki;				// Summing error (Integral term), Q4
+		if(Sum>(signed long)GainISum) Sum=GainISum;				// Limit summing error
+		else if(Sum<-(signed long)GainISum) Sum=-(signed long)GainISum;
+		Sum_E[axis] = (signed int)Sum;
+	}
+	if((Error0>-2)&&(Error0<2)) Sum_E[axis]=0;					// Clear summing error to reduce the oscillation
+
+	// PID output
+	Sum = (signed long)Proportional + (Sum_E[axis]>>4) + Derivative;	// Output = Proportional term + Integral term + Derivative term
+	if(Sum>255) Sum=255;										// Saturate before the terms could wrap an int
+	else if(Sum<-255) Sum=-255;
+	Output = (signed int)Sum;
+
+	// Previous errors saving for next Derivative term counting use
+	Error3[axis] = Error2[axis];
+	Error2[axis] = Error1[axis];
+	Error1[axis] = FineError;
+
+	return DeadZone(Output);
+}
+
+#else
+/********************************************************************
+*       Function Name:  PositionLoop                                *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*       Description:    Outer loop of the cascade, runs at 100Hz.   *
+*                       Position P term plus the setpoint velocity  *
+*                       gives the velocity command. The setpoint    *
+*                       acceleration is kept for the velocity loop  *
+*                       feedforward. A setpoint step (faster than   *
+*                       VELOCITY_MAX) is not fed forward.           *
+********************************************************************/
+static void PositionLoop(unsigned char axis)
+{
+	signed int Error0, Feed, Command;
+
+	Error0 = DesirePosition[axis] + BacklashOffset[axis] - CurrentPosition[axis];	// Counting current error
+	if(Error0>1000) Error0=1000;							// Keep Error0*KPP in range
+	else if(Error0<-1000) Error0=-1000;
+
+	// Setpoint velocity and acceleration
+	Feed = DesirePosition[axis] - LastDesire[axis];
+	LastDesire[axis] = DesirePosition[axis];
+	if((Feed>VELOCITY_MAX/16)||(Feed<-VELOCITY_MAX/16)) Feed=0;	// Step, left to the P term, only ramps are fed forward
+	else Feed<<=4;
+	FeedAccel[axis] = Feed - FeedVelocity[axis];
+	FeedVelocity[axis] = Feed;
+
+	// Velocity command
+	if((Error0>-2)&&(Error0<2)&&(Feed==0))					// Hold still once the target is reached
+	{
+		Command = 0;
+		VelocitySum[axis] = 0;
+	}
+	else Command = Error0*CASCADE_KPP + Feed;
+	if(Command>VELOCITY_MAX) Command=VELOCITY_MAX;
+	else if(Command<-VELOCITY_MAX) Command=-VELOCITY_MAX;
+	VelocityCommand[axis] = Command;
+}
+#endif
+
+
+/********************************************************************
+*       Function Name:  SpeedRamp                                   *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*       Description:    Velocity mode, runs at 100Hz. Moves the     *
+*                       velocity command towards TargetSpeed by at  *
+*                       most VELOCITY_ACCEL, the step is fed        *
+*                       forward as acceleration.                    *
+********************************************************************/
+static void SpeedRamp(unsigned char axis)
+{
+	signed int Step;
+
+	Step = TargetSpeed[axis] - VelocityCommand[axis];
+	if(Step>VELOCITY_ACCEL) Step=VELOCITY_ACCEL;
+	else if(Step<-VELOCITY_ACCEL) Step=-VELOCITY_ACCEL;
+	VelocityCommand[axis] += Step;
+	FeedAccel[axis] = Step;
+}
+
+
+/********************************************************************
+*       Function Name:  VelocityLoop                                *
+*       Return Value:   signed int: motor speed, -255 to 255        *
+*       Parameters:     axis: axis number                           *
+*       Description:    Velocity PI loop, runs every tick: inner    *
+*                       loop of the cascade and velocity mode. PI   *
+*                       on the speed error plus velocity and        *
+*                       acceleration feedforward.                   *
+********************************************************************/
+static signed int VelocityLoop(unsigned char axis)
+{
+	signed int VelocityError;
+	signed long Output;
+
+	VelocityError = VelocityCommand[axis] - MeasuredSpeed[axis];
+
+	VelocitySum[axis] += VelocityError;						// Integral term
+	if(VelocitySum[axis]>VELOCITY_ISUM) VelocitySum[axis]=VELOCITY_ISUM;
+	else if(VelocitySum[axis]<-VELOCITY_ISUM) VelocitySum[axis]=-VELOCITY_ISUM;
+
+	if((VelocityCommand[axis]==0)&&(VelocitySum[axis]==0)) return 0;	// Brake at the target
+
+	Output = (signed long)VelocityCommand[axis]*VELOCITY_KFF	// Velocity feedforward
+		   + (signed long)FeedAccel[axis]*VELOCITY_KAFF			// Acceleration feedforward
+		   + (signed long)VelocityError*VELOCITY_KP				// Proportional term
+		   + (signed long)VelocitySum[axis]*VELOCITY_KI;		// Integral term
+	Output >>= 4;
+	if(Output>255) Output=255;
+	else if(Output<-255) Output=-255;
+
+	return DeadZone((signed int)Output);
+}
+
+
+/********************************************************************
+*       Function Name:  UpdateMetrics                               *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       Output: motor output of this tick           *
+*       Description:    This routine adds one controlled tick to    *
+*                       the move metrics, before LastOutput is      *
+*                       updated. The counts stop at 65535 ticks.    *
+********************************************************************/
+static void UpdateMetrics(unsigned char axis, signed int Output)
+{
+	signed int Error0;
+	MOVE_METRICS *Move;
+
+	Move = &MoveMetrics[axis];
+	if(Move->Ticks==0xFFFF) return;
+	Move->Ticks++;
+	if(Output<0)
+	{
+		Move->Duty += -Output;
+		if(LastOutput[axis]>0) Move->Reversals++;
+	}
+	else
+	{
+		Move->Duty += Output;
+		if((Output>0)&&(LastOutput[axis]<0)) Move->Reversals++;
+	}
+	if((Output>=255)||(Output<=-255)) Move->Saturated++;
+	Error0 = DesirePosition[axis] + BacklashOffset[axis] - CurrentPosition[axis];
+	if((Error0>IDLE_BAND)||(Error0<-IDLE_BAND)) Move->Settle = Move->Ticks;
+}
+
+
+/********************************************************************
+*       Function Name:  TraceWatch                                  *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number (TRACE_AXIS)              *
+*       Description:    This routine triggers the trace recorder on *
+*                       a runaway: with the target unchanged, the   *
+*                       position error over TRACE_TRIGGER_ERROR has *
+*                       grown on TRACE_TRIGGER_TICKS ticks in a     *
+*                       row. A normal move only shrinks the error   *
+*                       after its step. Position mode only.         *
+********************************************************************/
+static void TraceWatch(unsigned char axis)
+{
+	signed int Error0;
+	unsigned int Magnitude;
+
+	Error0 = DesirePosition[axis] + BacklashOffset[axis] - CurrentPosition[axis];
+	Magnitude = (Error0<0) ? -Error0 : Error0;
+	if((DesirePosition[axis]==WatchTarget)&&(Magnitude>WatchError)&&(Magnitude>TRACE_TRIGGER_ERROR))
+	{
+		if(++WatchTicks>=TRACE_TRIGGER_TICKS) TraceTrigger();
+	}
+	else WatchTicks = 0;
+	WatchTarget = DesirePosition[axis];
+	WatchError = Magnitude;
+}
+
+
+/********************************************************************
+*       Function Name:  Parked                                      *
+*       Return Value:   unsigned char: 1 while the axis is parked   *
+*       Parameters:     axis: axis number                           *
+*       Description:    This routine parks an axis that has held    *
+*                       its target for IDLE_TIME ticks and wakes it *
+*                       when it drifts. A drift is held with the    *
+*                       winding braked the next time it parks.      *
+********************************************************************/
+static unsigned char Parked(unsigned char axis)
+{
+#if IDLE_TIME
+	signed int Error0;
+	unsigned char Bit;
+
+	Bit = 1<<axis;
+	Error0 = DesirePosition[axis] + BacklashOffset[axis] - CurrentPosition[axis];
+	if((AxisMode[axis]!=MODE_POSITION)||(Error0>IDLE_BAND)||(Error0<-IDLE_BAND))
+	{
+		if(IdleAxes&Bit)
+		{
+			IdleAxes &= ~Bit;				// Drifted, the controller takes over
+			IdleHold[axis] = MOTOR_HOLD_BRAKE;
+		}
+		IdleTicks[axis] = 0;
+		return 0;
+	}
+	if(IdleAxes&Bit) return 1;
+	if(++IdleTicks[axis]<IDLE_TIME) return 0;
+	IdleAxes |= Bit;						// On target long enough
+	MotorHold(axis, IdleHold[axis]);
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+
+/********************************************************************
+*       Function Name:  ControlUpdate                               *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine steps the controller of every  *
+*                       axis enabled in PIDEnable, in the mode set  *
+*                       in AxisMode. Called from ISRHigh on every   *
+*                       Timer 1 tick: 100Hz for the position PID,   *
+*                       400Hz for the cascade (position loop and    *
+*                       speed ramp every CONTROL_DIVIDER ticks).    *
+*                       An axis with a fault stays braked, a parked *
+*                       axis is left alone. Moves scheduled for     *
+*                       this tick start first. Ends with the        *
+*                       deadline check and the reload of the next   *
+*                       tick (refer control.h).                     *
+********************************************************************/
+void ControlUpdate(void)
+{
+	signed int Output, Integral, Trim;
+	unsigned int Start, Now, Tick;
+	unsigned char axis;
+
+	Start = Tick = ReadTimer1();
+	PeriodReload = TickReload;				// Loaded for this tick
+	ControlTick++;
+	if(++OuterCount>=CONTROL_DIVIDER) OuterCount=0;
+	for(axis=0; axis<NUM_AXES; axis++)
+	{
+		MeasuredSpeed[axis] = EdgeSpeed[axis];	// Speed from the edge period, Q4 (refer encoder.h)
+
+		if((StartAxes&(1<<axis))&&((signed int)(ControlTick-StartTick[axis])>=0))
+		{
+			StartAxes &= ~(1<<axis);
+			SetPosition(axis, StartPosition[axis]);	// Scheduled move, on the same tick on every synced node
+		}
+
+		if(AxisFault[axis]!=FAULT_NONE)
+		{
+			if(((HomeState==HOME_SEEK)||(HomeState==HOME_PROBE))&&(axis==HomeAxis))
+			{
+				INTCON3bits.INT2IE = 0;
+				HomeState = HOME_FAILED;
+			}
+			MotorOutput(axis, 0);	// Braked until ClearFault()
+			if(axis==TRACE_AXIS)
+			{
+				TraceTrigger();		// Keep the ticks that led to the fault
+				TraceRecord(CurrentPosition[axis], DesirePosition[axis], FinePosition[axis]-(CurrentPosition[axis]<<4), BacklashOffset[axis], Tick, 0, 0);
+			}
+		}
+		else if(((HomeState==HOME_SEEK)||(HomeState==HOME_PROBE))&&(axis==HomeAxis))
+		{
+			Output = HomeSpeed;		// Seek the home edge at constant speed
+			if(++HomeTicks>=HOME_TIMEOUT)
+			{
+				INTCON3bits.INT2IE = 0;
+				DesirePosition[axis] = CurrentPosition[axis];
+				ResetAxis(axis);
+				HomeState = HOME_FAILED;
+				Output = 0;
+			}
+			MotorOutput(axis, Output);
+		}
+		else if((PIDEnable&(1<<axis))&&!Parked(axis))	// Test for PID Enable, parked axes are left alone
+		{
+			if(AxisMode[axis]==MODE_VELOCITY)
+			{
+				Integral = VelocitySum[axis];
+				if(OuterCount==0) SpeedRamp(axis);
+				Output = VelocityLoop(axis);
+			}
+			else
+			{
+#if CONTROL_CASCADE
+				Integral = VelocitySum[axis];
+				if(OuterCount==0) PositionLoop(axis);
+				Output = VelocityLoop(axis);
+#else
+				Integral = Sum_E[axis];			// Q4, as kept
+				Output = PositionPID(axis);
+#endif
+			}
+#if CURRENT_SENSE
+			Output = CurrentLimit(axis, Output);	// Torque limit and stall check (refer current.c)
+#endif
+			UpdateMetrics(axis, Output);
+			LastOutput[axis] = Output;
+			MotorOutput(axis, Output);
+			if((axis==TRACE_AXIS)&&(ShedTicks==0))
+			{
+				TraceRecord(CurrentPosition[axis], DesirePosition[axis], FinePosition[axis]-(CurrentPosition[axis]<<4), BacklashOffset[axis], Tick, Integral, Output);
+				if(AxisMode[axis]==MODE_POSITION) TraceWatch(axis);
+			}
+		}
+
+		Now = ReadTimer1();
+		if(Now-Start > AxisCycles[axis]) AxisCycles[axis] = Now-Start;	// Cycle cost of this axis
+		Start = Now;
+	}
+
+	// Deadline check
+	Now = Start-PeriodReload;				// Cycles since the tick
+	if(Now > ControlCycles) ControlCycles = Now;
+	if(Now > CONTROL_BUDGET) ShedTicks = CONTROL_SHED_TICKS;
+	else if(ShedTicks) ShedTicks--;
+	if(PIR1bits.TMR1IF)						// Next tick already due
+	{
+		Overruns++;
+		if(++OverrunRun>=CONTROL_OVERRUN_LIMIT)
+		{
+			for(axis=0; axis<NUM_AXES; axis++)
+			{
+				AxisFault[axis] = FAULT_OVERRUN;
+				MotorOutput(axis, 0);		// Safe brake, the next ticks only hold it
+			}
+			OverrunRun = 0;
+		}
+	}
+	else OverrunRun = 0;
+
+	// Phase trim, at most SYNC_SLEW cycles per tick
+	Trim = PhaseTrim;
+	if(Trim>(signed int)SYNC_SLEW) Trim = SYNC_SLEW;
+	else if(Trim<-(signed int)SYNC_SLEW) Trim = -(signed int)SYNC_SLEW;
+	PhaseTrim -= Trim;
+	TickReload = CONTROL_RELOAD + Trim;		// Positive shortens the next tick
+}
+
+
+/********************************************************************
+*       Function Name:  MoveReport                                  *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine writes the metrics of the      *
+*                       present move of every axis over the EUSART  *
+*                       in hex, do not call it from interrupts:     *
+*                       "MOVE <axis> <ticks> <duty> <saturated>     *
+*                       <reversals> <settle>", duty in 8 digits.    *
+********************************************************************/
+void MoveReport(void)
+{
+	MOVE_METRICS Move;
+	unsigned char axis;
+
+	for(axis=0; axis<NUM_AXES; axis++)
+	{
+		PIE1bits.TMR1IE = 0;		// Consistent copy
+		Move = MoveMetrics[axis];
+		PIE1bits.TMR1IE = 1;
+		putrsSerial("MOVE ");
+		puthexSerial(axis);
+		putcSerial(' ');
+		puthexSerial(Move.Ticks);
+		putcSerial(' ');
+		puthexSerial((unsigned int)(Move.Duty>>16));
+		puthexSerial((unsigned int)Move.Duty);
+		putcSerial(' ');
+		puthexSerial(Move.Saturated);
+		putcSerial(' ');
+		puthexSerial(Move.Reversals);
+		putcSerial(' ');
+		puthexSerial(Move.Settle);
+		putrsSerial("\r\n");
+	}
+}
+
+
+/********************************************************************
+*       Function Name:  ScheduleMove                                *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       Position: desire position                   *
+*                       Tick: control tick number of the start      *
+*       Description:    This routine calls SetPosition() from the   *
+*                       control tick numbered Tick. A tick number   *
+*                       already passed starts the move on the next  *
+*                       tick.                                       *
+********************************************************************/
+void ScheduleMove(unsigned char axis, unsigned int Position, unsigned int Tick)
+{
+	PIE1bits.TMR1IE = 0;			// Hold off the control tick
+	StartPosition[axis] = Position;
+	StartTick[axis] = Tick;
+	StartAxes |= 1<<axis;
+	PIE1bits.TMR1IE = 1;
+}
+
+
+/********************************************************************
+*       Function Name:  SyncControl                                 *
+*       Return Value:   void                                        *
+*       Parameters:     Tick: number of the next control tick       *
+*       Description:    This routine takes the present moment as    *
+*                       half a tick before control tick Tick. It    *
+*                       measures the phase error from Timer 1,      *
+*                       renumbers ControlTick and starts the phase  *
+*                       trim. Call it from ISRLow at the end of a   *
+*                       sync frame. A sync within ControlCycles     *
+*                       after a tick is ignored.                    *
+********************************************************************/
+void SyncControl(unsigned int Tick)
+{
+	unsigned int Phase;
+
+	INTCONbits.GIEH = 0;			// Timer 1 and tick number read together
+	Phase = ReadTimer1()-PeriodReload;		// Cycles since the last tick
+	if(!PIR1bits.TMR1IF && (Phase>ControlCycles) && (Phase<CONTROL_PERIOD))
+	{
+		SyncError = (signed int)Phase - (signed int)(CONTROL_PERIOD/2);
+		PhaseTrim = -SyncError;		// Early ticks (positive error) are stretched
+		ControlTick = Tick-1;		// The next tick is number Tick, early or late
+		Syncs++;
+	}
+	INTCONbits.GIEH = 1;
+}
+
+
+/********************************************************************
+*       Function Name:  SyncReport                                  *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine writes the tick number, the    *
+*                       phase error of the last sync in cycles and  *
+*                       the number of syncs taken over the EUSART   *
+*                       in hex: "SYNC <tick> <error> <syncs>".      *
+********************************************************************/
+void SyncReport(void)
+{
+	unsigned int Tick, Count;
+	signed int Error;
+
+	PIE1bits.TMR1IE = 0;			// Consistent copy
+	INTCONbits.GIEL = 0;
+	Tick = ControlTick;
+	Error = SyncError;
+	Count = Syncs;
+	INTCONbits.GIEL = 1;
+	PIE1bits.TMR1IE = 1;
+	putrsSerial("SYNC ");
+	puthexSerial(Tick);
+	putcSerial(' ');
+	puthexSerial(Error);
+	putcSerial(' ');
+	puthexSerial(Count);
+	putrsSerial("\r\n");
+}
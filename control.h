@@ -0,0 +1,337 @@
+#ifndef __CONTROL_H
+#define __CONTROL_H
+
+/* N-axis position controller.
+ *
+ *   Notes:
+ *		- Per-axis state is kept in arrays indexed by axis number,
+ *		  so one ControlUpdate() pass steps every axis with the
+ *		  same code and no per-axis copies of the PID.
+ *		- NUM_AXES sets the number of axes (default 1). On SK40C:
+ *          - Axis 0: QEI module (RA3/RA4) in SPG-30E-QEI.c,
+ *            INT0/INT1 decoder (RC3/RC4) in SPG-30E-INT.c.
+ *            Driven by L293D channel 1 (refer motor.h).
+ *          - Axis 1: INT0/INT1 decoder (RC3/RC4), SPG-30E-QEI.c only.
+ *            Driven by L293D channel 2, CCP1 (RC2) on the enable
+ *            and RE0/RE1 on the inputs.
+ *		- CONTROL_CASCADE selects the controller:
+ *          - 0: position PID at 100Hz with scheduled gains. The
+ *            gains are read from GainTable by the size of the
+ *            error, interpolated between the band edges.
+ *            Near the target they are the original tutorial PID
+ *            (Kp 4, Ki 1, Kd 22). Further out Ki is 0 and Kp/Kd
+ *            fall, so the output leaves saturation gradually
+ *            instead of switching from full speed to the PID at
+ *            150 counts. When the error moves into another band
+ *            the integral is preloaded so the output carries on
+ *            from the last one.
+ *          - 1: outer position P loop at 100Hz giving a velocity
+ *            command, inner velocity PI loop at 400Hz, with
+ *            velocity and acceleration feedforward taken from
+ *            the change of DesirePosition[] between updates.
+ *            Move the setpoint in small steps every 10ms to
+ *            benefit from the feedforward, a change over
+ *            VELOCITY_MAX/16 counts is a step and is not fed
+ *            forward.
+ *		- AxisMode[] selects per axis, at run time:
+ *          - MODE_POSITION: the controller above chases
+ *            DesirePosition[], set with SetPosition().
+ *          - MODE_VELOCITY: a PI loop on the measured speed holds
+ *            TargetSpeed[], set with SetSpeed(). The command ramps
+ *            to the target by VELOCITY_ACCEL every 10ms.
+ *		  Switching is bumpless: the new loop is preloaded so its
+ *		  first output matches the last output of the old one.
+ *		  Call SetPosition()/SetSpeed() from the main program only,
+ *		  they hold off the control tick while the mode changes.
+ *		- The user must update CurrentPosition[] before calling
+ *		  ControlUpdate() from the Timer 1 interrupt, as the raw
+ *		  encoder count minus HomeOffset[axis], and pass it to
+ *		  EncoderTick() or EncoderSample() for FinePosition[] and
+ *		  EdgeSpeed[] (refer encoder.h). MeasuredSpeed[] is taken
+ *		  from EdgeSpeed[], the position PID derivative term from
+ *		  FinePosition[].
+ *		- Homing (HOME_INPUT = 1): StartHome() drives the axis at
+ *		  HOME_SPEED until the home switch (or an encoder index
+ *		  pulse) on INT2 (RC5) gives an edge. The user must call
+ *		  HomeLatch() with the raw count in the INT2 interrupt,
+ *		  so the reference is taken from the count at the edge
+ *		  and is repeatable to one count. The axis then returns
+ *		  to position 0. The SPG-30E-30K encoder has no index
+ *		  channel and RA2 (INDX) cannot interrupt, hence INT2.
+ *		  With HOME_INPUT = 0 position 0 is the power-up position.
+ *		- Backlash: the gearbox output lags the motor shaft (where
+ *		  the encoder sits) by Backlash[axis] counts after a
+ *		  reversal. Positions are referenced to a clockwise
+ *		  (negative) approach, the same direction as the home
+ *		  seek, so SetPosition() adds Backlash[axis] to the target
+ *		  of every counter-clockwise move and the output shaft
+ *		  stops at the same place from either side. Backlash[]
+ *		  starts at BACKLASH_COUNTS. StartProbe() finds the home
+ *		  edge again from the other side, arming the opposite
+ *		  transition (the flag is left, not entered), and
+ *		  ProbePosition gives the motor travel taken up by the
+ *		  dead band (refer CalibrateBacklash() in the main
+ *		  program). Use an index or optical flag on the output
+ *		  shaft for this: a mechanical switch releases away from
+ *		  where it closed and its hysteresis is not subtracted.
+ *		- AxisFault[] latches a protection fault per axis (refer
+ *		  current.h). A faulted axis is braked and its controller
+ *		  skipped until ClearFault(), which holds the axis where
+ *		  it stopped.
+ *		- Parking (IDLE_TIME > 0): an axis in position mode that
+ *		  stays within IDLE_BAND of its target for IDLE_TIME ticks
+ *		  is parked. Its controller stops and MotorHold() takes
+ *		  the drive off (coast). If it drifts out of the band the
+ *		  controller takes over on the same tick and the axis
+ *		  parks with the winding braked from then on, until the
+ *		  next move. SetPosition(), SetSpeed() and ClearFault()
+ *		  wake it. ControlIdle() is true when every enabled axis
+ *		  is parked, the main program can then idle the CPU
+ *		  between interrupts (OSCCON.IDLEN, Sleep()).
+ *		- ControlTick counts control ticks, wrapping at 65536.
+ *		- Sync: boards on one bus (refer serial.h) run their own
+ *		  Timer 1, so their ticks drift apart. SyncControl() is
+ *		  called at the end of a broadcast sync frame, which every
+ *		  node receives at the same moment, and takes it as half
+ *		  a tick before tick number Tick. The phase error is the
+ *		  Timer 1 count from there; it is removed by trimming the
+ *		  reload by up to SYNC_SLEW cycles per tick, so a tick is
+ *		  never stretched by more than 0.5%, and ControlTick is
+ *		  renumbered to match. SyncError holds the last error in
+ *		  cycles (0.2us), before its correction: the difference
+ *		  between the SyncError of two nodes is their phase
+ *		  error at that sync. Send syncs about once a second
+ *		  to follow crystal drift (50ppm is 2.5 cycles per
+ *		  tick). A sync received within ControlCycles of a tick
+ *		  may have waited for ISRHigh and is ignored. Other high
+ *		  priority interrupts (encoder edges) delay the capture by
+ *		  a few microseconds.
+ *		- ScheduleMove() sets the target of an axis on a given
+ *		  tick number, so synced nodes start a move on the same
+ *		  tick and, with the same gains and load, arrive together.
+ *		- MoveMetrics[] accumulates, on every controlled tick of a
+ *		  move, how hard the motor was driven: summed |output|,
+ *		  ticks at full output, output reversals and the ticks
+ *		  until the error last left IDLE_BAND (settle time). A
+ *		  move starts with SetPosition() to a new target or
+ *		  SetSpeed() to a new speed. MoveReport() writes them.
+ *		- Timer 1 runs at Fosc/4, so its count is the number of
+ *		  instruction cycles since the tick. ControlCycles and
+ *		  AxisCycles[] hold the worst case seen since reset.
+ *		- Deadline: the next tick must not be pending when
+ *		  ControlUpdate() ends. Each miss counts in Overruns,
+ *		  CONTROL_OVERRUN_LIMIT misses in a row brake every axis
+ *		  with FAULT_OVERRUN, which leaves the tick with nothing
+ *		  but the brake to do. A tick longer than CONTROL_BUDGET
+ *		  sets ShedTicks, the main program and the trace recorder
+ *		  skip low priority work (LCD refresh, serial telemetry)
+ *		  until it counts down to 0. The user should clear the
+ *		  watchdog after each ControlUpdate(), so a stopped tick
+ *		  resets the PIC.
+ */
+
+#ifndef NUM_AXES
+#define NUM_AXES			1
+#endif
+
+#define AXIS_ALL			((1<<NUM_AXES)-1)	/* PIDEnable mask for every axis */
+
+#ifndef CONTROL_CASCADE
+#define CONTROL_CASCADE		0					/* 1: cascaded position/velocity loops */
+#endif
+
+#if !CONTROL_CASCADE
+#define CONTROL_RELOAD		0x3CAF				/* Timer 1 value for 100Hz (10ms) */
+#define CONTROL_DIVIDER		1					/* Ticks per position loop update */
+#else
+#define CONTROL_RELOAD		0xCF2C				/* Timer 1 value for 400Hz (2.5ms) */
+#define CONTROL_DIVIDER		4					/* Ticks per position loop update */
+#endif
+
+#ifndef HOME_INPUT
+#define HOME_INPUT			0		/* 1: home switch or index pulse on INT2 (RC5) */
+#endif
+#define HOME_EDGE			0		/* INTEDG2: 0 falling (switch to ground), 1 rising */
+#define HOME_SPEED			-150	/* Seek speed, negative for clockwise */
+#define HOME_TIMEOUT		(1000*CONTROL_DIVIDER)	/* Seek ticks before giving up, 10s */
+
+#define HOME_IDLE			0
+#define HOME_SEEK			1
+#define HOME_DONE			2
+#define HOME_FAILED			3
+#define HOME_PROBE			4
+
+#ifndef BACKLASH_COUNTS
+#define BACKLASH_COUNTS		0		/* Gearbox dead band in counts, until calibrated */
+#endif
+#ifndef BACKLASH_CALIBRATE
+#define BACKLASH_CALIBRATE	0		/* 1: measure the dead band after homing (needs HOME_INPUT) */
+#endif
+#define BACKLASH_CLEAR		60		/* Counts backed off before the probe approach */
+#define BACKLASH_MAX		40		/* Largest dead band accepted, counts */
+
+#define FAULT_NONE			0
+#define FAULT_STALL			1		/* Current without motion (refer current.h) */
+#define FAULT_OVERLOAD		2		/* Current over the limit too long */
+#define FAULT_OVERRUN		3		/* Control tick missed its deadline too often */
+
+#define CONTROL_PERIOD		((unsigned int)(0x10000L-CONTROL_RELOAD))	/* Cycles per tick */
+#define CONTROL_BUDGET		((unsigned int)(CONTROL_PERIOD*3L/4))	/* Cycles, 3/4 of the tick */
+#define CONTROL_OVERRUN_LIMIT	8	/* Missed deadlines in a row before braking */
+#define CONTROL_SHED_TICKS	(100*CONTROL_DIVIDER)	/* Low priority work held off for 1s */
+#define SYNC_SLEW			(CONTROL_PERIOD/200)	/* Largest reload trim per tick, cycles */
+
+#ifndef IDLE_TIME
+#define IDLE_TIME			(200*CONTROL_DIVIDER)	/* Ticks on target before parking, 2s, 0 never parks */
+#endif
+#define IDLE_BAND			1		/* Counts from the target a parked axis may drift */
+#define IDLE_WAIT			(2*CONTROL_DIVIDER)	/* Ticks the main program idles in place of an LCD refresh */
+#define ControlIdle()		((PIDEnable!=0)&&(IdleAxes==PIDEnable))
+
+#define MODE_POSITION		0		/* AxisMode: chase DesirePosition[] */
+#define MODE_VELOCITY		1		/* AxisMode: hold TargetSpeed[] */
+
+/* Speeds are counts per 10ms in Q4 fixed point (16 = 1 count).
+ * The SPG-30E-30K gives 360 counts per output shaft turn with
+ * 4x decoding and peaks near 9 counts per 10ms at full drive.
+ */
+#define COUNTS_PER_REV		360
+#define RPM_TO_SPEED(rpm)	((signed int)((rpm)*(COUNTS_PER_REV*16L)/6000))
+
+/* Velocity loop gains, Q4 fixed point (16 = 1.0), shared by the
+ * velocity mode and the inner loop of the cascade.
+ */
+#define VELOCITY_KP			32		/* Output per unit of velocity error */
+#define VELOCITY_KI			2		/* Output per unit of summed velocity error */
+#define VELOCITY_KFF		28		/* Output per unit of velocity command */
+#define VELOCITY_KAFF		8		/* Output per unit of command acceleration */
+#define VELOCITY_MAX		160		/* Velocity command limit */
+#define VELOCITY_ISUM		1600	/* Summed velocity error limit */
+#define VELOCITY_ACCEL		4		/* Velocity mode ramp per 10ms */
+
+#define CASCADE_KPP			16		/* Velocity command per count of position error */
+
+#define GAIN_BANDS			4		/* Rows of GainTable */
+#define GAIN_ISUM			(240*16)	/* Position PID integral limit, Q4, until SetGains() */
+#define DEAD_ZONE			140		/* Least output that turns the motor, until SetGains() */
+#define GAIN_DIFF_MAX		(255*16)	/* Largest Q4 error change over 3 ticks taken by the D term */
+
+/* Position PID gain schedule, gains in Q4 (16 = 1.0). Each row gives
+ * the gains at an error size (counts), rows in rising error order.
+ * Gains are interpolated between rows and held past the last one.
+ */
+typedef struct
+{
+	unsigned int Error;
+	unsigned int Kp, Ki, Kd;
+} GAIN_BAND;
+
+typedef struct
+{
+	unsigned long Duty;			/* Sum of |output| per tick, 255 = full drive */
+	unsigned int Ticks;			/* Controlled ticks since the move started */
+	unsigned int Saturated;		/* Ticks at full output */
+	unsigned int Settle;		/* Ticks until the error last left IDLE_BAND */
+	unsigned int Reversals;		/* Output sign changes, at most one per tick */
+} MOVE_METRICS;
+
+#define TMR1_RELOAD			{TMR1H=TickReload>>8; TMR1L=TickReload&0xFF;}
+
+extern unsigned char PIDEnable;					/* Bit n enables the PID of axis n */
+extern unsigned int CurrentPosition[NUM_AXES];
+extern unsigned int DesirePosition[NUM_AXES];
+extern unsigned char AxisMode[NUM_AXES];
+extern signed int TargetSpeed[NUM_AXES];		/* Velocity mode target */
+extern signed int MeasuredSpeed[NUM_AXES];		/* Speed from the encoder edge period */
+extern unsigned int HomeOffset[NUM_AXES];		/* Raw count at position 0 */
+extern unsigned char HomeAxis, HomeState;
+extern unsigned int ProbePosition;				/* Position at the edge found by StartProbe() */
+extern unsigned char Backlash[NUM_AXES];		/* Dead band added to counter-clockwise targets */
+extern unsigned char AxisFault[NUM_AXES];		/* FAULT_NONE, or why the axis is braked */
+extern unsigned int ControlCycles;				/* Worst cycles from tick to end of ControlUpdate */
+extern unsigned int AxisCycles[NUM_AXES];		/* Worst cycles of one axis step */
+extern unsigned char IdleAxes;					/* Bit n set while axis n is parked */
+extern unsigned int ControlTick;				/* Control ticks, the shared tick number once synced */
+extern unsigned int TickReload;					/* Timer 1 value for the next tick (TMR1_RELOAD) */
+extern signed int SyncError;					/* Phase error at the last sync, cycles */
+extern unsigned int Syncs;						/* Syncs taken since reset */
+extern MOVE_METRICS MoveMetrics[NUM_AXES];		/* Present move of each axis */
+extern unsigned int Overruns;					/* Ticks that missed the deadline */
+extern unsigned int ShedTicks;					/* Non zero: skip low priority work */
+extern GAIN_BAND GainTable[GAIN_BANDS];			/* Position PID gain schedule */
+extern unsigned int GainISum;					/* Position PID integral limit, Q4 */
+extern unsigned char DeadZoneOutput;			/* Least output that turns the motor */
+
+
+/* OpenControl
+ * Clears position, target and PID state of every axis
+ */
+void OpenControl(void);
+
+/* SetPosition
+ * Sets the target position, switches a velocity mode axis to position mode,
+ * compensates backlash by the direction of the move
+ */
+void SetPosition(unsigned char axis, unsigned int Position);
+
+/* HoldPosition
+ * Switches an axis to position mode at its present position
+ */
+void HoldPosition(unsigned char axis);
+
+/* SetSpeed
+ * Sets the target speed, switches a position mode axis to velocity mode
+ */
+void SetSpeed(unsigned char axis, signed int Speed);
+
+/* SetGains
+ * Replaces the position PID gain schedule, integral limit and motor dead zone
+ */
+void SetGains(GAIN_BAND *Gains, unsigned int ISum, unsigned char DeadZone);
+
+/* ClearFault
+ * Clears the fault of an axis, it holds its present position
+ */
+void ClearFault(unsigned char axis);
+
+/* StartHome
+ * Starts the home seek of one axis, HomeState tells when it ends
+ */
+void StartHome(unsigned char axis);
+
+/* StartProbe
+ * Drives one axis at Speed until the home edge without moving the reference
+ */
+void StartProbe(unsigned char axis, signed int Speed);
+
+/* HomeLatch
+ * Takes the raw count at the home edge, call from the INT2 interrupt
+ */
+void HomeLatch(unsigned int Count);
+
+/* ControlUpdate
+ * Runs one PID step for every enabled axis
+ */
+void ControlUpdate(void);
+
+/* MoveReport
+ * Writes the metrics of the present move of every axis over the EUSART
+ */
+void MoveReport(void);
+
+/* ScheduleMove
+ * Sets the target position of an axis on control tick number Tick
+ */
+void ScheduleMove(unsigned char axis, unsigned int Position, unsigned int Tick);
+
+/* SyncControl
+ * Aligns the tick phase to a sync received now, the next tick is number Tick
+ */
+void SyncControl(unsigned int Tick);
+
+/* SyncReport
+ * Writes the tick number and the last phase error over the EUSART
+ */
+void SyncReport(void);
+
+#endif
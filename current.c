@@ -0,0 +1,192 @@
+#include <p18f4431.h>
+#include "motor.h"
+#include "control.h"
+#include "current.h"
+#include "serial.h"
+
+unsigned int Current[NUM_AXES];
+unsigned char OutputLimit[NUM_AXES];
+static unsigned int CurrentFilter[NUM_AXES];		// Q4
+static unsigned int StallTicks[NUM_AXES], OverTicks[NUM_AXES];
+static unsigned char Channel;
+
+
+/********************************************************************
+*       Function Name:  OpenCurrent                                 *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine configures the ADC for single  *
+*                       conversions on AN0/AN1 and the 1:16 start   *
+*                       of conversion: the PCPWM special event      *
+*                       trigger, or the Timer 2 interrupt for CCP2. *
+*                       AN0 and AN1 must be left analog in ANSEL0.  *
+********************************************************************/
+void OpenCurrent(void)
+{
+	unsigned char axis;
+
+	for(axis=0; axis<NUM_AXES; axis++)
+	{
+		Current[axis] = 0;
+		CurrentFilter[axis] = 0;
+		OutputLimit[axis] = 255;
+		StallTicks[axis] = 0;
+		OverTicks[axis] = 0;
+	}
+	Channel = 0;
+
+	ADCHS  = 0b00000000;		// AN0 in group A, AN1 in group B
+	ADCON1 = 0b00000000;		// AVdd and AVss reference, FIFO off
+	ADCON2 = 0b10001010;		// Right justified, 2 Tad acquisition, Fosc/32 (Tad 1.6us)
+	ADCON0 = 0b00000001;		// Single shot, single channel group A, ADC on
+
+#if MOTOR_DRIVE == MOTOR_DRIVE_CCP2
+	ADCON3 = 0b00000000;		// No hardware trigger, started by CurrentStart()
+	T2CON |= 0b01111000;		// Timer 2 postscale 1:16, the PWM is not affected
+	IPR1bits.TMR2IP = 1;		// High priority, the start must not wait for ISRLow
+	PIR1bits.TMR2IF = 0;
+	PIE1bits.TMR2IE = 1;
+#else
+	SEVTCMPH = CURRENT_TRIGGER>>8;
+	SEVTCMPL = CURRENT_TRIGGER;
+	PWMCON1 |= 0b11110000;		// Special event postscale 1:16, on the way up
+	ADCON3 = 0b00010000;		// Started by the PCPWM special event trigger
+#endif
+	IPR1bits.ADIP = 0;			// Low priority, reading the result can wait
+	PIR1bits.ADIF = 0;
+	PIE1bits.ADIE = 1;
+}
+
+
+#if MOTOR_DRIVE == MOTOR_DRIVE_CCP2
+/********************************************************************
+*       Function Name:  CurrentStart                                *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine clears the Timer 2 interrupt   *
+*                       and starts a conversion, unless the period  *
+*                       is already past CURRENT_LATE or the last    *
+*                       conversion is still running.                *
+********************************************************************/
+void CurrentStart(void)
+{
+	PIR1bits.TMR2IF = 0;
+	if(TMR2>CURRENT_LATE) return;				// Held off by ISRHigh, skip this period
+	if(ADCON0bits.GO) return;
+	ADCON0bits.GO = 1;							// Acquisition time is added by the ADC
+}
+#endif
+
+
+/********************************************************************
+*       Function Name:  CurrentSample                               *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine clears CurrentFlag, filters    *
+*                       the conversion and selects the channel of   *
+*                       the next one. The filter adds               *
+*                       1/2^CURRENT_FILTER of the difference        *
+*                       between sample and output.                  *
+********************************************************************/
+void CurrentSample(void)
+{
+	unsigned int Sample, Filter;
+
+	CurrentFlag = 0;
+	Sample = (unsigned int)ADRESH<<8 | ADRESL;
+	Filter = CurrentFilter[Channel];
+	Filter = Filter - (Filter>>CURRENT_FILTER) + ((Sample<<4)>>CURRENT_FILTER);
+	CurrentFilter[Channel] = Filter;
+
+	INTCONbits.GIEH = 0;						// ControlUpdate() reads it in ISRHigh
+	Current[Channel] = Filter>>4;
+	INTCONbits.GIEH = 1;
+
+#if NUM_AXES > 1
+	if(++Channel>=NUM_AXES) Channel = 0;
+	ADCON0 = 0b00000001 | (Channel<<2);			// Group A (AN0) or B (AN1)
+#endif
+}
+
+
+/********************************************************************
+*       Function Name:  CurrentLimit                                *
+*       Return Value:   signed int: motor speed, -255 to 255        *
+*       Parameters:     axis: axis number                           *
+*                       Output: controller output                   *
+*       Description:    This routine clamps the output of one axis  *
+*                       to its output limit and runs the overload   *
+*                       and stall checks. A fault brakes the axis.  *
+*                       Called from ControlUpdate() on every tick.  *
+********************************************************************/
+signed int CurrentLimit(unsigned char axis, signed int Output)
+{
+	unsigned int Amps;
+	signed int Speed;
+
+	Amps = Current[axis];
+	Speed = MeasuredSpeed[axis];
+
+	// Overload, torque limit
+	if(Amps>CURRENT_LIMIT)
+	{
+		if(OutputLimit[axis]>CURRENT_LIMIT_MIN+CURRENT_LIMIT_STEP) OutputLimit[axis] -= CURRENT_LIMIT_STEP;
+		else OutputLimit[axis] = CURRENT_LIMIT_MIN;
+		OverTicks[axis]++;
+	}
+	else
+	{
+		if(OutputLimit[axis]<255) OutputLimit[axis]++;
+		OverTicks[axis] = 0;
+	}
+
+	// Stall, current without motion
+	if((Output!=0)&&(Amps>CURRENT_STALL)&&(Speed<CURRENT_STALL_SPEED)&&(Speed>-CURRENT_STALL_SPEED)) StallTicks[axis]++;
+	else StallTicks[axis] = 0;
+
+	if(StallTicks[axis]>=CURRENT_STALL_TICKS) AxisFault[axis] = FAULT_STALL;
+	else if(OverTicks[axis]>=CURRENT_OVERLOAD_TICKS) AxisFault[axis] = FAULT_OVERLOAD;
+	if(AxisFault[axis]!=FAULT_NONE)
+	{
+		StallTicks[axis] = 0;
+		OverTicks[axis] = 0;
+		OutputLimit[axis] = 255;				// Full limit again after ClearFault()
+		return 0;
+	}
+
+	if(Output>(signed int)OutputLimit[axis]) Output = OutputLimit[axis];
+	else if(Output<-(signed int)OutputLimit[axis]) Output = -(signed int)OutputLimit[axis];
+	return Output;
+}
+
+
+/********************************************************************
+*       Function Name:  CurrentReport                               *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine writes the filtered current,   *
+*                       output limit and fault of every axis over   *
+*                       the EUSART in hex:                          *
+*                       "CUR <axis> <current> <limit> <fault>".     *
+********************************************************************/
+void CurrentReport(void)
+{
+	unsigned char axis;
+	unsigned int Amps;
+
+	for(axis=0; axis<NUM_AXES; axis++)
+	{
+		INTCONbits.GIEH = 0;
+		Amps = Current[axis];
+		INTCONbits.GIEH = 1;
+		putrsSerial("CUR ");
+		puthexSerial(axis);
+		putcSerial(' ');
+		puthexSerial(Amps);
+		putcSerial(' ');
+		puthexSerial(OutputLimit[axis]);
+		putcSerial(' ');
+		puthexSerial(AxisFault[axis]);
+		putrsSerial("\r\n");
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef __CURRENT_H
+#define __CURRENT_H
+
+/* Motor current monitoring, stall and overload protection.
+ *
+ *   Notes:
+ *		- The L293D has no current sense output. CURRENT_SENSE = 1
+ *		  needs a sense resistor of CURRENT_SENSE_MOHM between the
+ *		  L293D ground pins and 0V, read on AN0 (RA0). The ground
+ *		  pins are common to both channels, so axis 1 (AN1, RA1)
+ *		  needs its own driver and resistor.
+ *		- The motor current only flows through the resistor while
+ *		  the PWM output is on, so the ADC is started near the
+ *		  start of a PWM period, where the output turns on, every
+ *		  16 periods (305Hz):
+ *          - PCPWM: the special event trigger starts it in
+ *            hardware CURRENT_TRIGGER counts into the period
+ *            (SEVTCMP, postscale 1:16 in PWMCON1).
+ *          - CCP2: no trigger follows Timer 2, the user must call
+ *            CurrentStart() from ISRHigh when CurrentStartFlag is
+ *            set (Timer 2, postscale 1:16, high priority). The
+ *            period is skipped when ISRHigh gets there later than
+ *            CURRENT_LATE, the output may be off by then.
+ *		  The user must call CurrentSample() from ISRLow when
+ *		  CurrentFlag (ADIF) is set, it reads the conversion and
+ *		  selects the channel of the next one. With two axes the
+ *		  channels take turns.
+ *		- Each sample goes through a first order low pass filter
+ *		  in Q4 fixed point, time constant 2^CURRENT_FILTER
+ *		  samples. Current[axis] is the filtered value in ADC
+ *		  counts, MA_TO_ADC() converts from mA.
+ *		- CurrentLimit() runs in ControlUpdate() on every tick:
+ *          - Overload: above CURRENT_LIMIT the output limit of the
+ *            axis steps down towards the dead zone minimum, and
+ *            recovers slowly once below. The axis faults with
+ *            FAULT_OVERLOAD after CURRENT_OVERLOAD_TICKS over.
+ *          - Stall: above CURRENT_STALL while the encoder speed
+ *            stays under CURRENT_STALL_SPEED for CURRENT_STALL_TICKS
+ *            the axis faults with FAULT_STALL.
+ *		  A faulted axis stays braked until ClearFault() (refer
+ *		  control.h).
+ */
+
+#ifndef CURRENT_SENSE
+#define CURRENT_SENSE			0			/* 1: sense resistor on AN0 (AN1 for axis 1) */
+#endif
+
+#define CURRENT_SENSE_MOHM		500			/* Sense resistor, milliohms */
+#define MA_TO_ADC(ma)			((unsigned int)((ma)*(unsigned long)CURRENT_SENSE_MOHM*1024/5000000UL))
+
+#define CURRENT_FILTER			3			/* Filter time constant, 8 samples */
+#define CURRENT_LIMIT			MA_TO_ADC(600)	/* L293D continuous rating per channel */
+#define CURRENT_STALL			MA_TO_ADC(450)
+#define CURRENT_STALL_SPEED		16			/* Q4 counts per 10ms, 1 count */
+#define CURRENT_STALL_TICKS		(50*CONTROL_DIVIDER)	/* 0.5s */
+#define CURRENT_OVERLOAD_TICKS	(100*CONTROL_DIVIDER)	/* 1s */
+#define CURRENT_LIMIT_STEP		8			/* Output limit drop per tick over the limit */
+#define CURRENT_LIMIT_MIN		140			/* Motor dead zone, refer DeadZone() */
+#define CURRENT_TRIGGER			16			/* PCPWM: SEVTCMP, 3.2us after the output turns on */
+#define CURRENT_LATE			100			/* CCP2: latest TMR2 start, 80us (dead zone duty is 140) */
+
+#define CurrentFlag				PIR1bits.ADIF
+#if MOTOR_DRIVE == MOTOR_DRIVE_CCP2
+#define CurrentStartFlag		(PIE1bits.TMR2IE && PIR1bits.TMR2IF)
+#endif
+
+extern unsigned int Current[];					/* Filtered current per axis, ADC counts */
+extern unsigned char OutputLimit[];				/* Present output limit per axis */
+
+
+/* OpenCurrent
+ * Configures the ADC and the PWM period interrupt, call after OpenMotor()
+ */
+void OpenCurrent(void);
+
+#if MOTOR_DRIVE == MOTOR_DRIVE_CCP2
+/* CurrentStart
+ * Starts one conversion at the start of the PWM period, call from ISRHigh
+ */
+void CurrentStart(void);
+#endif
+
+/* CurrentSample
+ * Reads and filters one conversion, call from ISRLow
+ */
+void CurrentSample(void);
+
+/* CurrentLimit
+ * Limits the output of one axis by its current, faults a stalled axis
+ */
+signed int CurrentLimit(unsigned char axis, signed int Output);
+
+/* CurrentReport
+ * Writes the current, output limit and fault of every axis over the EUSART
+ */
+void CurrentReport(void);
+
+#endif
@@ -0,0 +1,244 @@
+#include <p18f4431.h>
+#include "encoder.h"
+#include "control.h"
+#include "serial.h"
+
+/* Count change for each (previous state<<2)|state, ENCODER_SKIP
+ * marks a transition where both channels changed (missed edge).
+ */
+#define ENCODER_SKIP	2
+static const rom signed char QuadTable[16] =
+{
+	 0, -1,  1,  ENCODER_SKIP,		// Previous state 0,0
+	 1,  0,  ENCODER_SKIP, -1,		// Previous state 0,1
+	-1,  ENCODER_SKIP,  0,  1,		// Previous state 1,0
+	 ENCODER_SKIP,  1, -1,  0		// Previous state 1,1
+};
+
+static unsigned char PreviousState[NUM_AXES];
+static signed char LastStep[NUM_AXES];
+static unsigned int EdgeTime[NUM_AXES], EdgePeriod[NUM_AXES];
+static unsigned int LastPosition[NUM_AXES];
+static unsigned char StillTicks[NUM_AXES], Restart[NUM_AXES];
+static unsigned char Stopped[NUM_AXES];
+unsigned int EncoderCount[NUM_AXES];
+unsigned int EncoderErrors[NUM_AXES], EncoderGlitches[NUM_AXES];
+unsigned int FinePosition[NUM_AXES];
+signed int EdgeSpeed[NUM_AXES];
+
+
+/********************************************************************
+*       Function Name:  ReadTimer0                                  *
+*       Return Value:   unsigned int: Timer 0 count                 *
+*       Parameters:     void                                        *
+*       Description:    This routine reads the 16 bits Timer 0      *
+*                       count, TMR0H is latched when TMR0L is read. *
+********************************************************************/
+static unsigned int ReadTimer0(void)
+{
+	unsigned int Count;
+	Count = TMR0L;
+	Count |= (unsigned int)TMR0H<<8;
+	return Count;
+}
+
+
+/********************************************************************
+*       Function Name:  OpenEncoder                                 *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       State: channel state (B<<1)|A               *
+*       Description:    This routine sets the starting state of an  *
+*                       axis so the first edge is counted right,    *
+*                       and starts the Timer 0 edge time base.      *
+********************************************************************/
+void OpenEncoder(unsigned char axis, unsigned char State)
+{
+	T0CON = 0b10000010;					// Timer 0 on, 16 bits, Fosc/4, prescale 1:8
+	PreviousState[axis] = State;
+	LastStep[axis] = 0;
+	EncoderCount[axis] = 0;
+	EdgeTime[axis] = 0;
+	EdgePeriod[axis] = 0xFFFF;
+	LastPosition[axis] = 0;
+	StillTicks[axis] = ENCODER_STOP_TICKS;
+	Restart[axis] = 2;
+	Stopped[axis] = 1;
+	FinePosition[axis] = 0;
+	EdgeSpeed[axis] = 0;
+	EncoderErrors[axis] = 0;
+	EncoderGlitches[axis] = 0;
+}
+
+
+/********************************************************************
+*       Function Name:  QuadDecode                                  *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       State: channel state (B<<1)|A               *
+*       Description:    This routine counts one step up or down     *
+*                       from the previous channel state. Forward    *
+*                       sequence is 0,2,3,1 (4x decoding).          *
+*                       An unchanged state (edge bounced back       *
+*                       before it was read) does not count. Both    *
+*                       channels changed means an edge was missed:  *
+*                       two steps are counted in the last direction *
+*                       and EncoderErrors is increased. A reversal  *
+*                       within ENCODER_DEBOUNCE of the last step is *
+*                       rejected as a glitch, unless the axis was   *
+*                       stopped: the time base may have wrapped     *
+*                       since the last step. The edge period is     *
+*                       kept for EncoderTick(), unknown (longest)   *
+*                       after a reversal.                           *
+********************************************************************/
+void QuadDecode(unsigned char axis, unsigned char State)
+{
+	signed char Step;
+	unsigned int Now;
+
+	Now = ReadTimer0();
+	Step = QuadTable[(PreviousState[axis]<<2)|State];
+	if(Step==0)							// Edge bounced back before it was read
+	{
+		EncoderGlitches[axis]++;
+		return;
+	}
+	if(Step==ENCODER_SKIP)
+	{
+		Step = LastStep[axis]<<1;		// Two steps in the last direction
+		EdgePeriod[axis] = (Now-EdgeTime[axis])>>1;
+		EncoderErrors[axis]++;
+	}
+	else if((Step==-LastStep[axis])&&(!Stopped[axis])&&(Now-EdgeTime[axis]<ENCODER_DEBOUNCE))
+	{
+		EncoderGlitches[axis]++;		// Reversal too soon after the last step, keep the previous state
+		return;
+	}
+	else
+	{
+		if(Step==LastStep[axis]) EdgePeriod[axis] = Now-EdgeTime[axis];
+		else EdgePeriod[axis] = 0xFFFF;	// Reversal, no period yet
+		LastStep[axis] = Step;
+	}
+	EncoderCount[axis] += Step;
+	PreviousState[axis] = State;		// Save the current state value for next state use
+	EdgeTime[axis] = Now;
+	Stopped[axis] = 0;
+}
+
+
+/********************************************************************
+*       Function Name:  EncoderSince                                *
+*       Return Value:   unsigned int: Timer 0 counts (1.6us)        *
+*       Parameters:     axis: axis number                           *
+*       Description:    This routine gives the time since the last  *
+*                       edge counted by QuadDecode().               *
+********************************************************************/
+unsigned int EncoderSince(unsigned char axis)
+{
+	return ReadTimer0()-EdgeTime[axis];
+}
+
+
+/********************************************************************
+*       Function Name:  EncoderTick                                 *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       Position: position of the axis at this tick *
+*       Description:    This routine interpolates a software        *
+*                       decoder axis from its Timer 0 edge times.   *
+*                       Call from ISRHigh, edges must not update    *
+*                       the axis in between.                        *
+********************************************************************/
+void EncoderTick(unsigned char axis, unsigned int Position)
+{
+	EncoderSample(axis, Position, ReadTimer0()-EdgeTime[axis], EdgePeriod[axis], LastStep[axis]);
+}
+
+
+/********************************************************************
+*       Function Name:  EncoderSample                               *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       Position: position of the axis at this tick *
+*                       Since: time since the last edge, 1.6us      *
+*                       Period: time between the last two edges     *
+*                       Direction: sign of the last count           *
+*       Description:    This routine sets FinePosition and          *
+*                       EdgeSpeed of an axis. The shaft is taken to *
+*                       keep the speed of the last edge period, but *
+*                       not to pass the next edge: when the edge is *
+*                       late, the time since the last one becomes   *
+*                       the period and the speed falls with it.     *
+*                       The period of the first edges after a stop  *
+*                       spans the wrap of the time base and is not  *
+*                       used.                                       *
+********************************************************************/
+void EncoderSample(unsigned char axis, unsigned int Position, unsigned int Since, unsigned int Period, signed char Direction)
+{
+	unsigned char Fraction;
+	signed int Speed;
+
+	if(Position!=LastPosition[axis])
+	{
+		LastPosition[axis] = Position;
+		StillTicks[axis] = 0;
+		if(Restart[axis]) Restart[axis]--;
+	}
+	else if(StillTicks[axis]<ENCODER_STOP_TICKS) StillTicks[axis]++;
+
+	if(StillTicks[axis]>=ENCODER_STOP_TICKS)	// Stopped, the edge time may have wrapped
+	{
+		EdgeSpeed[axis] = 0;
+		Restart[axis] = 2;
+		Stopped[axis] = 1;						// Next reversal is not debounced
+		return;									// Fine position stays where it stopped
+	}
+
+	if(Restart[axis]) Period = 0xFFFF;			// Period of the first edge is not valid
+	if(Period<ENCODER_MIN_PERIOD) Period = ENCODER_MIN_PERIOD;
+	if(Since>=Period)							// Next edge is late, slowing down
+	{
+		Period = Since;
+		Fraction = 15;
+	}
+	else Fraction = ((unsigned long)Since<<4)/Period;
+	Speed = ENCODER_SPEED_SCALE/Period;
+
+	if(Direction<0)
+	{
+		FinePosition[axis] = (Position<<4) - Fraction;
+		EdgeSpeed[axis] = -Speed;
+	}
+	else
+	{
+		FinePosition[axis] = (Position<<4) + Fraction;
+		EdgeSpeed[axis] = Speed;
+	}
+}
+
+
+/********************************************************************
+*       Function Name:  EncoderReport                               *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine writes the missed edge and     *
+*                       glitch counts of every axis over the EUSART *
+*                       in hex: "ENC <axis> <errors> <glitches>".   *
+*                       Counts of axes on the QEI module stay 0.    *
+********************************************************************/
+void EncoderReport(void)
+{
+	unsigned char axis;
+
+	for(axis=0; axis<NUM_AXES; axis++)
+	{
+		putrsSerial("ENC ");
+		puthexSerial(axis);
+		putcSerial(' ');
+		puthexSerial(EncoderErrors[axis]);
+		putcSerial(' ');
+		puthexSerial(EncoderGlitches[axis]);
+		putrsSerial("\r\n");
+	}
+}
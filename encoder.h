@@ -0,0 +1,98 @@
+#ifndef __ENCODER_H
+#define __ENCODER_H
+
+/* Software quadrature decoder for encoders on interrupt pins.
+ *
+ *   Notes:
+ *		- The user must call QuadDecode() from ISRHigh on every
+ *		  edge of either channel, with the channel state read
+ *		  right after the edge: (channel B<<1)|channel A.
+ *		- The raw count is kept in EncoderCount[axis], the user
+ *		  copies it to CurrentPosition[] on every control tick.
+ *		- Repeated states are not counted. Transitions where both
+ *		  channels changed are counted as two steps in the last
+ *		  direction and recorded in EncoderErrors[axis].
+ *		- Software debounce: a step reversing the last one less
+ *		  than ENCODER_DEBOUNCE Timer 0 counts after it is taken
+ *		  as a glitch and ignored, the edge back is ignored too.
+ *		  Rejected edges are counted in EncoderGlitches[axis].
+ *		  The SPG-30E-30K encoder edges are at least 1ms apart
+ *		  at full speed, so real reversals are never that fast.
+ *		  The first step after ENCODER_STOP_TICKS without a count
+ *		  is not debounced, Timer 0 may have wrapped since the
+ *		  last one and the time between them is not known.
+ *		- Timer 0 runs free at Fosc/4 /8 (1.6us per count) as the
+ *		  edge time base, started by OpenEncoder().
+ *		- ENCODER_FILTER is written to DFLTCON by the user. The
+ *		  digital noise filters pass a level once it has been
+ *		  stable for 3 filter clocks (3 x 16 x 0.2us = 9.6us):
+ *          - FLT1EN filters INT0 (RC3, INT decoder channel B)
+ *          - FLT2EN-FLT4EN filter QEA, QEB and INDX (RA3, RA4, RA2)
+ *		  INT1 (RC4) has no hardware filter. The QEI has no count
+ *		  of filtered pulses, glitch counts are only kept for the
+ *		  software decoder.
+ *		- Edge timing: the time of the last edge and the period
+ *		  between the last two edges give, at every control tick,
+ *		  a position interpolated between counts and a speed that
+ *		  does not wait for several counts to change:
+ *          - FinePosition[axis]: position in Q4 (16 = 1 count),
+ *            the fraction is the time since the last edge over
+ *            the edge period, at most 15/16 of a count ahead.
+ *          - EdgeSpeed[axis]: counts per 10ms in Q4 from the edge
+ *            period, or from the time since the last edge once
+ *            that is longer. 0 after ENCODER_STOP_TICKS without a
+ *            count, before the time base wraps (105ms).
+ *		  The software decoder times edges with Timer 0, the user
+ *		  calls EncoderTick() on each control tick. The QEI module
+ *		  times them with Timer 5 in velocity mode (QEICON.VELM = 0,
+ *		  VELR holds the period and Timer 5 restarts on each count),
+ *		  the user passes TMR5 and VELR to EncoderSample().
+ */
+
+#ifndef ENCODER_FILTER
+#define ENCODER_FILTER		0b01111011		/* DFLTCON: FLT1EN-FLT4EN, filter clock Fosc/4 /16 */
+#endif
+#define ENCODER_DEBOUNCE	12				/* Timer 0 counts, about 20us */
+#define ENCODER_TIMER5		0b00011001		/* T5CON: Timer 5 on, Fosc/4, prescale 1:8 like Timer 0 */
+#define ENCODER_SPEED_SCALE	100000L			/* Q4 counts per 10ms x 1.6us edge time base */
+#define ENCODER_MIN_PERIOD	64				/* Shortest edge period taken, 102us */
+#define ENCODER_STOP_TICKS	(6*CONTROL_DIVIDER)	/* Control ticks without a count before speed is 0 */
+
+extern unsigned int EncoderCount[];				/* Raw count per axis */
+extern unsigned int EncoderErrors[];				/* Missed edges per axis */
+extern unsigned int EncoderGlitches[];				/* Rejected edges per axis */
+extern unsigned int FinePosition[];				/* Q4 position at the last control tick */
+extern signed int EdgeSpeed[];					/* Q4 counts per 10ms from the edge period */
+
+
+/* OpenEncoder
+ * Sets the starting channel state of an axis
+ */
+void OpenEncoder(unsigned char axis, unsigned char State);
+
+/* QuadDecode
+ * Updates the position of an axis from a new channel state
+ */
+void QuadDecode(unsigned char axis, unsigned char State);
+
+/* EncoderTick
+ * Interpolates a software decoder axis, call on every control tick
+ */
+void EncoderTick(unsigned char axis, unsigned int Position);
+
+/* EncoderSample
+ * Interpolates from the time since the last edge and the edge period
+ */
+void EncoderSample(unsigned char axis, unsigned int Position, unsigned int Since, unsigned int Period, signed char Direction);
+
+/* EncoderSince
+ * Timer 0 counts since the last edge of a software decoder axis
+ */
+unsigned int EncoderSince(unsigned char axis);
+
+/* EncoderReport
+ * Writes the error and glitch counts over the EUSART
+ */
+void EncoderReport(void);
+
+#endif
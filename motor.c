@@ -0,0 +1,183 @@
+#include <p18f4431.h>
+#include "motor.h"
+#include "control.h"
+#include "stack.h"
+
+#if MOTOR_DRIVE == MOTOR_DRIVE_PCPWM_LAP
+unsigned char MotorDir;
+unsigned int MotorDuty;
+#endif
+
+/********************************************************************
+*       Function Name:  OpenMotor                                   *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine configures the PWM module of   *
+*                       the selected drive backend. Both backends   *
+*                       run at 4.88kHz (Fosc 20MHz):                *
+*                       CCP2:  Fosc/4 /4 prescale /256 (PR2=255)    *
+*                       PCPWM: Fosc/4 /1024 (PTPER=1023)            *
+*                       The PCPWM pins are left as port pins until  *
+*                       StartMotor() is called.                     *
+********************************************************************/
+void OpenMotor(void)
+{
+#if MOTOR_DRIVE == MOTOR_DRIVE_CCP2
+	T2CON  	= 0b00000101;		// Timer 2 on, prescale 1:4
+	CCP2CON = 0b00001100;		// PWM mode
+	PR2	  	= 0b11111111;		// PR2 set to 255
+#else
+	LATCbits.LATC1 = 1;			// L293D enable held high
+	PTCON0	= 0b00000000;		// Postscale 1:1, Fosc/4, free running mode
+	PTPERH	= 0x03;				// PTPER set to 1023
+	PTPERL	= 0xFF;
+#if MOTOR_DRIVE == MOTOR_DRIVE_PCPWM_SM
+	PWMCON0	= 0b00000011;		// Pins disabled, pair 0 and pair 1 independent
+#else
+	PWMCON0	= 0b00000001;		// Pins disabled, pair 1 complementary
+	DTCON	= MOTOR_DEAD_TIME;	// Dead-time between PWM2 and PWM3
+#endif
+	PWMCON1	= 0b00000001;		// Output overrides synchronised to the time base
+	OVDCONS	= 0b00000000;		// Overridden outputs driven low
+	OVDCOND	= 0b00000000;
+#if NUM_AXES == 1
+	FLTCONFIG = 0b00010000;		// FLTB enabled, outputs off until cleared
+#endif
+	PTCON1	= 0b10000000;		// PWM time base on
+#endif
+	brake;
+
+#if NUM_AXES > 1
+	// Axis 1 on L293D channel 2
+	ANSEL0 &= 0b00111111;		// RE0 and RE1 set as digital
+	TRISE &= 0b11111100;		// RE0 and RE1 output
+	TRISCbits.TRISC2 = 0;		// CCP1 output
+	T2CON  	= 0b00000101;		// Timer 2 on, prescale 1:4 (shared with CCP2)
+	PR2	  	= 0b11111111;
+	CCP1CON = 0b00001100;		// PWM mode
+	brake1;
+#endif
+}
+
+
+/********************************************************************
+*       Function Name:  StartMotor                                  *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine enables the PCPWM output pins. *
+*                       PWM0-PWM3 are the smallest group that can   *
+*                       be enabled, PWM0/PWM1 (SW1/SW2) stay        *
+*                       overridden low. Nothing to do for CCP2.     *
+********************************************************************/
+void StartMotor(void)
+{
+#if MOTOR_DRIVE != MOTOR_DRIVE_CCP2
+	brake;
+	PWMCON0 |= 0b00110000;		// PWM0-PWM3 enabled
+#if MOTOR_DRIVE == MOTOR_DRIVE_PCPWM_LAP
+	OVDCOND = 0b00001100;		// Pair 1 follows the duty cycle
+#endif
+#endif
+}
+
+
+/********************************************************************
+*       Function Name:  MotorOutput                                 *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       speed: -255 to 255, sign gives direction    *
+*       Description:    This routine sets direction and speed of    *
+*                       one axis. Positive speed turns the motor    *
+*                       counter-clockwise, zero brakes it.          *
+********************************************************************/
+void MotorOutput(unsigned char axis, signed int speed)
+{
+	StackSample();					// Innermost call of the control tick (refer stack.h)
+	if(axis==0)
+	{
+#if MOTOR_DRIVE != MOTOR_DRIVE_CCP2
+		LATCbits.LATC1 = 1;			// Enable back on after MotorHold()
+#endif
+		if(speed>0)
+		{
+			ccw;
+			MotorSpeed(speed);
+		}
+		else if(speed<0)
+		{
+			cw;
+			MotorSpeed(-speed);
+		}
+		else brake;
+	}
+#if NUM_AXES > 1
+	else
+	{
+		if(speed>0)
+		{
+			ccw1;
+			MotorSpeed1(speed);
+		}
+		else if(speed<0)
+		{
+			cw1;
+			MotorSpeed1(-speed);
+		}
+		else brake1;
+	}
+#endif
+}
+
+
+/********************************************************************
+*       Function Name:  MotorHold                                   *
+*       Return Value:   void                                        *
+*       Parameters:     axis: axis number                           *
+*                       hold: MOTOR_HOLD_COAST or MOTOR_HOLD_BRAKE  *
+*       Description:    This routine parks one axis. Coast turns    *
+*                       the L293D channel off with its enable,      *
+*                       brake shorts the winding. Locked-antiphase  *
+*                       overrides both PWM outputs low to brake.    *
+********************************************************************/
+void MotorHold(unsigned char axis, unsigned char hold)
+{
+	if(axis==0)
+	{
+		brake;
+#if MOTOR_DRIVE == MOTOR_DRIVE_PCPWM_LAP
+		OVDCOND = 0b00000000;		// No 50% switching while parked
+#endif
+		if(hold==MOTOR_HOLD_COAST)
+		{
+#if MOTOR_DRIVE == MOTOR_DRIVE_CCP2
+			CCPR2L = 0;				// Enable low, outputs off
+#else
+			LATCbits.LATC1 = 0;
+#endif
+		}
+	}
+#if NUM_AXES > 1
+	else
+	{
+		brake1;
+		if(hold==MOTOR_HOLD_COAST) CCPR1L = 0;
+	}
+#endif
+}
+
+
+/********************************************************************
+*       Function Name:  ClearMotorFault                             *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine brakes the motor and clears    *
+*                       a latched FLTB fault. The fault stays set   *
+*                       if the FLTB pin is still low.               *
+********************************************************************/
+void ClearMotorFault(void)
+{
+#if MOTOR_DRIVE != MOTOR_DRIVE_CCP2
+	brake;
+	FLTCONFIGbits.FLTBS = 0;
+#endif
+}
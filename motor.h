@@ -0,0 +1,118 @@
+#ifndef __MOTOR_H
+#define __MOTOR_H
+
+/* PIC18 motor drive routines for the L293D H-bridge.
+ *
+ *   Notes:
+ *		- MOTOR_DRIVE selects the drive backend:
+ *          - MOTOR_DRIVE_CCP2: CCP2 PWM on RC1 (L293D enable),
+ *            direction on RB2/RB3. This is the SK40C tutorial wiring.
+ *          - MOTOR_DRIVE_PCPWM_SM: Power Control PWM, sign-magnitude.
+ *            PWM2/PWM3 (RB2/RB3) drive the L293D inputs directly
+ *            and RC1 holds the enable high. The idle input is
+ *            overridden low so the wiring is unchanged.
+ *          - MOTOR_DRIVE_PCPWM_LAP: Power Control PWM, locked-antiphase.
+ *            PWM2/PWM3 run as a complementary pair with hardware
+ *            dead-time, 50% duty is standstill.
+ *		- The PCPWM time base runs at the same 4.88kHz as CCP2 but
+ *		  with 12 bits of duty resolution instead of 8.
+ *		- FLTB (RC2) shuts the PCPWM outputs down in hardware when
+ *		  pulled low. The fault is latched until ClearMotorFault().
+ *		- The module has four output pairs, but on SK40C pair 0
+ *		  shares RB0/RB1 with SW1/SW2 and pairs 2/3 share the LCD
+ *		  port, so only pair 1 is used. PWM0/PWM1 are held
+ *		  overridden low and are only enabled by StartMotor(),
+ *		  i.e. after the switches have been read.
+ *		- Speed arguments are 0-255 for every backend.
+ *		- MotorHold() parks an axis with the least drive: with
+ *		  MOTOR_HOLD_COAST the L293D enable is pulled low, so the
+ *		  outputs are off and the driver draws its lowest supply
+ *		  current. MOTOR_HOLD_BRAKE shorts the winding through the
+ *		  low side, which resists back-driving. The next
+ *		  MotorOutput() drives the axis again.
+ *		- Axis 1 (NUM_AXES > 1, refer control.h) always runs on CCP1
+ *		  (RC2) and RE0/RE1. FLTB also sits on RC2, so the PCPWM
+ *		  fault input is only enabled for a single axis.
+ */
+
+#define MOTOR_DRIVE_CCP2		0
+#define MOTOR_DRIVE_PCPWM_SM	1
+#define MOTOR_DRIVE_PCPWM_LAP	2
+
+#ifndef MOTOR_DRIVE
+#define MOTOR_DRIVE			MOTOR_DRIVE_CCP2
+#endif
+
+#define MOTOR_DEAD_TIME		0b00001010	/* DTCON: Fosc/2, 10 counts = 1us */
+#define MOTOR_LAP_MID		2048		/* 50% duty for locked-antiphase */
+
+#define MOTOR_HOLD_COAST		0
+#define MOTOR_HOLD_BRAKE		1
+
+#if MOTOR_DRIVE == MOTOR_DRIVE_CCP2
+
+#define cw	{LATBbits.LATB2=1; LATBbits.LATB3=0;}				// Motor clockwise turn
+#define ccw {LATBbits.LATB2=0; LATBbits.LATB3=1;}				// Motor counter-clockwise turn
+#define brake {LATBbits.LATB2=0; LATBbits.LATB3=0; CCPR2L=255;}	// Motor brake
+#define MotorSpeed(s)	{CCPR2L=(s);}							// Motor speed (0-255)
+
+#elif MOTOR_DRIVE == MOTOR_DRIVE_PCPWM_SM
+
+#define cw	{OVDCOND=0b00000100;}								// PWM on RB2, RB3 low
+#define ccw {OVDCOND=0b00001000;}								// PWM on RB3, RB2 low
+#define brake {OVDCOND=0; LATBbits.LATB2=0; LATBbits.LATB3=0;}	// Both inputs low
+#define MotorSpeed(s)	{PDC1H=(unsigned char)(s)>>4; PDC1L=(unsigned char)((s)<<4);}
+
+#elif MOTOR_DRIVE == MOTOR_DRIVE_PCPWM_LAP
+
+#define cw	{MotorDir=0; OVDCOND=0b00001100;}					// Duty below 50%
+#define ccw {MotorDir=1; OVDCOND=0b00001100;}					// Duty above 50%
+#define brake {MotorDir=0; LATBbits.LATB2=0; LATBbits.LATB3=0; SetMotorDuty(MOTOR_LAP_MID);}
+#define MotorSpeed(s)	{SetMotorDuty(MotorDir ? MOTOR_LAP_MID+((unsigned int)(s)<<3) : MOTOR_LAP_MID-((unsigned int)(s)<<3));}
+#define SetMotorDuty(d)	{MotorDuty=(d); PDC1H=MotorDuty>>8; PDC1L=MotorDuty;}
+
+extern unsigned char MotorDir;
+extern unsigned int MotorDuty;
+
+#else
+#error "Unknown MOTOR_DRIVE"
+#endif
+
+#define cw1	{LATEbits.LATE0=1; LATEbits.LATE1=0;}				// Axis 1 clockwise turn
+#define ccw1 {LATEbits.LATE0=0; LATEbits.LATE1=1;}				// Axis 1 counter-clockwise turn
+#define brake1 {LATEbits.LATE0=0; LATEbits.LATE1=0; CCPR1L=255;}	// Axis 1 brake
+#define MotorSpeed1(s)	{CCPR1L=(s);}							// Axis 1 speed (0-255)
+
+#if MOTOR_DRIVE == MOTOR_DRIVE_CCP2
+#define MotorFault()	0
+#else
+#define MotorFault()	(FLTCONFIGbits.FLTBS)
+#endif
+
+
+/* OpenMotor
+ * Configures the PWM module of the selected backend, motor stays braked
+ */
+void OpenMotor(void);
+
+/* StartMotor
+ * Hands the bridge pins over to the PWM module
+ */
+void StartMotor(void);
+
+/* MotorOutput
+ * Drives one axis, speed -255 to 255 (positive counter-clockwise, 0 brakes)
+ */
+void MotorOutput(unsigned char, signed int);
+
+/* MotorHold
+ * Parks one axis, MOTOR_HOLD_COAST or MOTOR_HOLD_BRAKE
+ */
+void MotorHold(unsigned char, unsigned char);
+
+/* ClearMotorFault
+ * Re-arms the PCPWM outputs after a FLTB shutdown
+ */
+void ClearMotorFault(void);
+
+#endif
@@ -0,0 +1,320 @@
+#include <p18f4431.h>
+#include "serial.h"
+#include "control.h"
+#include "stack.h"
+
+static volatile char SerialData;
+#if SERIAL_BUS
+unsigned int SerialArg;
+unsigned char NodeAddress;
+static volatile unsigned int FrameArg;
+static char Frame[SERIAL_FRAME_MAX];
+static unsigned char FrameLength, Broadcast, Replying, ReplyCrc;
+#endif
+
+
+/********************************************************************
+*       Function Name:  Crc8                                        *
+*       Return Value:   unsigned char: new CRC                      *
+*       Parameters:     crc: CRC so far                             *
+*                       data: next byte                             *
+*       Description:    This routine adds one byte to a CRC-8,      *
+*                       polynomial x^8+x^2+x+1 (0x07).              *
+********************************************************************/
+unsigned char Crc8(unsigned char crc, char data)
+{
+	unsigned char i;
+
+	crc ^= data;
+	for(i=0; i<8; i++)
+	{
+		if(crc&0x80) crc = (crc<<1)^0x07;
+		else crc <<= 1;
+	}
+	return crc;
+}
+
+
+#if SERIAL_BUS
+/********************************************************************
+*       Function Name:  HexDigit                                    *
+*       Return Value:   unsigned char: 0-15, 0xFF if not hex        *
+*       Parameters:     data: character                             *
+*       Description:    This routine converts an upper case hex     *
+*                       digit.                                      *
+********************************************************************/
+static unsigned char HexDigit(char data)
+{
+	if((data>='0')&&(data<='9')) return data-'0';
+	if((data>='A')&&(data<='F')) return data-'A'+10;
+	return 0xFF;
+}
+
+
+/********************************************************************
+*       Function Name:  ParseFrame                                  *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine checks a received frame, hex   *
+*                       digits, CRC and address, and hands its      *
+*                       command and argument to getcSerial(). A     *
+*                       sync frame goes to SyncControl() instead.   *
+********************************************************************/
+static void ParseFrame(void)
+{
+	unsigned char i, crc, address, check;
+	unsigned int arg;
+
+	if(FrameLength<5) return;					// AA C KK at least
+	crc = 0;
+	for(i=0; i<FrameLength; i++)
+	{
+		if((i!=2)&&(HexDigit(Frame[i])==0xFF)) return;	// Every character but the command is a hex digit
+		if(i<FrameLength-2) crc = Crc8(crc, Frame[i]);
+	}
+	check = (HexDigit(Frame[FrameLength-2])<<4) | HexDigit(Frame[FrameLength-1]);
+	if(check!=crc) return;
+
+	address = (HexDigit(Frame[0])<<4) | HexDigit(Frame[1]);
+	if((address!=NodeAddress)&&(address!=SERIAL_BROADCAST)) return;
+
+	arg = 0;
+	for(i=3; i<FrameLength-2; i++) arg = (arg<<4) | HexDigit(Frame[i]);	// At most 4 digits (SERIAL_FRAME_MAX)
+	if((Frame[2]==SERIAL_SYNC)&&(address==SERIAL_BROADCAST))
+	{
+		SyncControl(arg);						// Served at once, the end of the frame is the time reference
+		return;
+	}
+	FrameArg = arg;
+	Broadcast = (address==SERIAL_BROADCAST);
+	SerialData = Frame[2];
+}
+#endif
+
+
+/********************************************************************
+*       Function Name:  OpenSerial                                  *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine configures the EUSART for      *
+*                       asynchronous 8 bits mode and enables the    *
+*                       receive interrupt at low priority. Interrupt*
+*                       priorities (RCON.IPEN) must be enabled.     *
+********************************************************************/
+void OpenSerial(void)
+{
+	SPBRGH	= 0;
+	SPBRG	= SERIAL_SPBRG;
+	BAUDCTL	= 0b00001000;		// 16 bits baud rate generator
+	TXSTA	= 0b00100100;		// Transmit enabled, high speed
+	RCSTA	= 0b10010000;		// Serial port enabled, continuous receive
+	SerialData = 0;
+#if SERIAL_BUS
+	SerialArg = 0;
+	NodeAddress = NODE_ID;		// Until OpenConfig()
+	FrameLength = 0xFF;			// Wait for ':'
+	Replying = 0;
+	BusDriver = 0;				// Receive
+	ANSEL1 &= 0b11111110;		// RE2 set as digital
+	TRISEbits.TRISE2 = 0;		// DE output
+#endif
+
+	IPR1bits.RCIP = 0;			// Receive interrupt low priority
+	PIE1bits.RCIE = 1;
+	INTCONbits.GIEL = 1;
+}
+
+
+/********************************************************************
+*       Function Name:  SerialReceive                               *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine reads the receive register     *
+*                       and clears an overrun error. Only the last  *
+*                       byte (bus: the last frame) is kept.         *
+********************************************************************/
+void SerialReceive(void)
+{
+#if SERIAL_BUS
+	char data;
+#endif
+
+	if(RCSTAbits.OERR)			// Overrun stops the receiver
+	{
+		RCSTAbits.CREN = 0;
+		RCSTAbits.CREN = 1;
+	}
+#if SERIAL_BUS
+	data = RCREG;				// Reading RCREG clears RCIF
+	if(data==':') FrameLength = 0;				// Start of a frame
+	else if(FrameLength==0xFF) return;			// Not in a frame, replies of other nodes
+	else if(data=='\r')
+	{
+		ParseFrame();
+		FrameLength = 0xFF;
+	}
+	else if(FrameLength<SERIAL_FRAME_MAX) Frame[FrameLength++] = data;
+	else FrameLength = 0xFF;					// Too long, drop it
+#else
+	SerialData = RCREG;			// Reading RCREG clears RCIF
+#endif
+}
+
+
+/********************************************************************
+*       Function Name:  getcSerial                                  *
+*       Return Value:   char: received byte, 0 if none              *
+*       Parameters:     void                                        *
+*       Description:    This routine returns and clears the last    *
+*                       received byte (bus: command of the last     *
+*                       frame, its argument goes to SerialArg).     *
+********************************************************************/
+char getcSerial(void)
+{
+	char data;
+
+	PIE1bits.RCIE = 0;
+	data = SerialData;
+	SerialData = 0;
+#if SERIAL_BUS
+	SerialArg = FrameArg;
+#endif
+	PIE1bits.RCIE = 1;
+	return data;
+}
+
+
+/********************************************************************
+*       Function Name:  DataRdySerial                               *
+*       Return Value:   char: non zero if a byte is waiting         *
+*       Parameters:     void                                        *
+*       Description:    This routine tells whether getcSerial()     *
+*                       has a byte, without taking it.              *
+********************************************************************/
+char DataRdySerial(void)
+{
+	return SerialData!=0;
+}
+
+
+/********************************************************************
+*       Function Name:  putcSerial                                  *
+*       Return Value:   void                                        *
+*       Parameters:     data: byte to be written                    *
+*       Description:    This routine waits for the transmit         *
+*                       register and writes one byte. On the bus    *
+*                       only inside a reply, and adds it to the     *
+*                       reply CRC.                                  *
+********************************************************************/
+void putcSerial(char data)
+{
+	StackSample();				// Innermost call of the reports (refer stack.h)
+#if SERIAL_BUS
+	if(!Replying) return;		// Broadcast, or outside a reply
+	ReplyCrc = Crc8(ReplyCrc, data);
+#endif
+	while(!TXSTAbits.TRMT);		// Wait for the previous byte
+	TXREG = data;
+}
+
+
+#if SERIAL_BUS
+/********************************************************************
+*       Function Name:  PutHex2                                     *
+*       Return Value:   void                                        *
+*       Parameters:     data: byte to be written                    *
+*       Description:    This routine writes a byte as 2 upper case  *
+*                       hex digits.                                 *
+********************************************************************/
+static void PutHex2(unsigned char data)
+{
+	unsigned char digit;
+
+	digit = data>>4;
+	putcSerial(digit<10 ? digit+'0' : digit-10+'A');
+	digit = data&0x0F;
+	putcSerial(digit<10 ? digit+'0' : digit-10+'A');
+}
+
+
+/********************************************************************
+*       Function Name:  StartReply                                  *
+*       Return Value:   void                                        *
+*       Parameters:     command: command being answered             *
+*       Description:    This routine takes the bus and writes the   *
+*                       reply header "!AAC\r\n". Nothing is sent    *
+*                       for a broadcast.                            *
+********************************************************************/
+void StartReply(char command)
+{
+	if(Broadcast) return;
+	BusDriver = 1;				// Drive the bus
+	while(!TXSTAbits.TRMT);
+	TXREG = '!';
+	ReplyCrc = 0;
+	Replying = 1;
+	PutHex2(NodeAddress);
+	putcSerial(command);
+	putrsSerial("\r\n");
+}
+
+
+/********************************************************************
+*       Function Name:  EndReply                                    *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine ends the reply with "*KK\r\n"  *
+*                       and releases the bus once the last bit is   *
+*                       out.                                        *
+********************************************************************/
+void EndReply(void)
+{
+	unsigned char crc;
+
+	if(!Replying) return;
+	crc = ReplyCrc;
+	putcSerial('*');
+	PutHex2(crc);
+	putrsSerial("\r\n");
+	while(!TXSTAbits.TRMT);		// Last stop bit sent
+	Replying = 0;
+	BusDriver = 0;				// Release the bus
+}
+#endif
+
+
+/********************************************************************
+*       Function Name:  putrsSerial                                 *
+*       Return Value:   void                                        *
+*       Parameters:     buffer: pointer to string in ROM            *
+*       Description:    This routine writes a string of bytes up to *
+*                       the null character.                         *
+********************************************************************/
+void putrsSerial(const rom char *buffer)
+{
+	while(*buffer)
+	{
+		putcSerial(*buffer);
+		buffer++;
+	}
+}
+
+
+/********************************************************************
+*       Function Name:  puthexSerial                                *
+*       Return Value:   void                                        *
+*       Parameters:     data: number to be written                  *
+*       Description:    This routine writes a 16 bits number as 4   *
+*                       upper case hex digits.                      *
+********************************************************************/
+void puthexSerial(unsigned int data)
+{
+	unsigned char i, digit;
+
+	for(i=0; i<4; i++)
+	{
+		digit = (data>>12)&0x0F;
+		putcSerial(digit<10 ? digit+'0' : digit-10+'A');
+		data <<= 4;
+	}
+}
@@ -0,0 +1,118 @@
+#ifndef __SERIAL_H
+#define __SERIAL_H
+
+/* PIC18 EUSART routines.
+ *
+ *   Notes:
+ *		- TX on RC6, RX on RC7, 8 bits, no parity, 1 stop bit.
+ *		- SERIAL_SPBRG sets the baud rate with BRG16 and BRGH set:
+ *		  Baud = Fosc / (4 * (SPBRG + 1)), 42 = 115200 at 20MHz.
+ *		- Reception is interrupt driven, the user must call
+ *		  SerialReceive() from ISRLow. Transmission waits for
+ *		  the transmit register, do not call it from interrupts.
+ *		- SERIAL_BUS = 0: single character commands, getcSerial()
+ *		  returns the last byte received.
+ *		- SERIAL_BUS = 1: addressed frames for an RS-485 multi-drop
+ *		  bus, the transceiver driver enable (DE, with /RE tied to
+ *		  it) on RE2. Frames are ASCII, hex digits in upper case:
+ *          - Request ":AAC[NNNN]KK\r": node address AA (00 is a
+ *            broadcast to every node), command character C, an
+ *            optional argument of 1 to 4 hex digits and KK, the
+ *            CRC-8 (polynomial 0x07, start 0) of the characters
+ *            from AA up to the argument.
+ *          - Reply "!AAC\r\n<report lines>*KK\r\n", KK the CRC-8
+ *            of the characters between '!' and '*'. Every request
+ *            to the node address gets one, broadcasts get none.
+ *		  A broadcast SERIAL_SYNC frame is not handed on, it is
+ *		  passed to SyncControl() (refer control.h) from the
+ *		  receive interrupt, the argument being the tick number.
+ *		  Frames with a bad CRC, a character other than an upper
+ *		  case hex digit outside the command, another address or
+ *		  more than SERIAL_FRAME_MAX characters (an argument over
+ *		  4 digits) are dropped. getcSerial() returns the command
+ *		  of a valid frame and SerialArg its argument. The user
+ *		  wraps the handling of a command in StartReply() and
+ *		  EndReply(), output written in between forms the reply
+ *		  body and is discarded for broadcasts. The reply starts
+ *		  when the main program next serves the command (one main
+ *		  loop pass, about 20ms), and its length is bounded by the
+ *		  longest report (TraceDump(), about 750 bytes or 65ms at
+ *		  115200 baud).
+ */
+
+#define SERIAL_SPBRG		42			/* 115200 baud at 20MHz */
+
+#ifndef SERIAL_BUS
+#define SERIAL_BUS			0			/* 1: addressed RS-485 frames */
+#endif
+#ifndef NODE_ID
+#define NODE_ID				0x01		/* Bus address of this node, 01-FF, until OpenConfig() */
+#endif
+#define SERIAL_FRAME_MAX	9			/* Characters between ':' and '\r': AA C NNNN KK */
+#define SERIAL_BROADCAST	0x00
+#define SERIAL_SYNC			'S'			/* Broadcast command served by SyncControl() */
+
+#define BusDriver			LATEbits.LATE2	/* RS-485 DE */
+
+#if SERIAL_BUS
+extern unsigned int SerialArg;			/* Argument of the last command, 0 if none */
+extern unsigned char NodeAddress;		/* Bus address, NODE_ID or the config record */
+#else
+#define StartReply(c)
+#define EndReply()
+#endif
+
+
+/* OpenSerial
+ * Configures the EUSART and enables the low priority receive interrupt
+ */
+void OpenSerial(void);
+
+/* SerialReceive
+ * Stores a received byte, call from ISRLow
+ */
+void SerialReceive(void);
+
+/* getcSerial
+ * Returns the last received byte, 0 if none
+ */
+char getcSerial(void);
+
+/* DataRdySerial
+ * Returns non zero while a received byte is waiting
+ */
+char DataRdySerial(void);
+
+#if SERIAL_BUS
+/* StartReply
+ * Starts the reply to a command, nothing is sent for a broadcast
+ */
+void StartReply(char);
+
+/* EndReply
+ * Ends the reply with its CRC and releases the bus
+ */
+void EndReply(void);
+#endif
+
+/* Crc8
+ * Adds one byte to a CRC-8, polynomial 0x07
+ */
+unsigned char Crc8(unsigned char crc, char data);
+
+/* putcSerial
+ * Writes one byte
+ */
+void putcSerial(char);
+
+/* putrsSerial
+ * Writes a string of characters in ROM
+ */
+void putrsSerial(const rom char *);
+
+/* puthexSerial
+ * Writes a 16 bits number as 4 hex digits
+ */
+void puthexSerial(unsigned int);
+
+#endif
@@ -0,0 +1,65 @@
+#include <p18f4431.h>
+#include "stack.h"
+#include "serial.h"
+
+unsigned char StackDepth, StackFlags;
+
+
+/********************************************************************
+*       Function Name:  OpenStack                                   *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine takes and clears the return    *
+*                       stack error flags and fills the software    *
+*                       stack from FSR1 to its end with STACK_PAINT.*
+*                       Call it before the interrupts are enabled.  *
+********************************************************************/
+void OpenStack(void)
+{
+	unsigned char *p;
+
+	StackFlags = STKPTR & 0b11000000;		// STKFUL, STKUNF
+	STKPTRbits.STKFUL = 0;
+	STKPTRbits.STKUNF = 0;
+	StackDepth = STKPTR & 0x1F;
+
+	p = (unsigned char *)((unsigned int)FSR1H<<8 | FSR1L);	// First free byte
+	while(p < (unsigned char *)(STACK_BASE+STACK_SIZE)) *p++ = STACK_PAINT;
+}
+
+
+/********************************************************************
+*       Function Name:  StackReport                                 *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine writes the stack use over the  *
+*                       EUSART in hex:                              *
+*                       "STK <depth> <levels> <flags> <used> <size>"*
+*                       depth of the return stack of STACK_LEVELS,  *
+*                       flags from start-up, software stack bytes   *
+*                       used of STACK_SIZE.                         *
+********************************************************************/
+void StackReport(void)
+{
+	unsigned char *p;
+	unsigned int Free;
+
+	Free = 0;
+	p = (unsigned char *)(STACK_BASE+STACK_SIZE-1);
+	while((Free<STACK_SIZE) && (*p==STACK_PAINT))
+	{
+		Free++;
+		p--;
+	}
+	putrsSerial("STK ");
+	puthexSerial(StackDepth);
+	putcSerial(' ');
+	puthexSerial(STACK_LEVELS);
+	putcSerial(' ');
+	puthexSerial(StackFlags);
+	putcSerial(' ');
+	puthexSerial(STACK_SIZE-Free);
+	putcSerial(' ');
+	puthexSerial(STACK_SIZE);
+	putrsSerial("\r\n");
+}
@@ -0,0 +1,51 @@
+#ifndef __STACK_H
+#define __STACK_H
+
+/* Hardware and software stack usage.
+ *
+ *   Notes:
+ *		- The PIC18 return stack holds 31 levels in hardware.
+ *		  STKPTR gives the present depth, StackSample() keeps the
+ *		  deepest seen in StackDepth. It is called in the
+ *		  innermost routines of the main program (putcSerial())
+ *		  and of the interrupts (MotorOutput(), TraceRecord()),
+ *		  so once a tick has landed on the deepest main path the
+ *		  mark includes the interrupt on top of it. C18 library
+ *		  calls (multiply, divide) go one or two levels deeper.
+ *		- STKFUL and STKUNF latch a return stack overflow or
+ *		  underflow. STVREN is on by default, so the PIC resets,
+ *		  and the flags survive the reset: OpenStack() copies
+ *		  them to StackFlags and clears them.
+ *		- C18 keeps arguments and locals on a software stack
+ *		  (FSR1, growing upwards) in the section reserved by the
+ *		  STACK directive of the linker script, STACK_BASE and
+ *		  STACK_SIZE must match it. OpenStack() fills the part
+ *		  above FSR1 with STACK_PAINT, StackReport() counts the
+ *		  bytes at the top still holding it. The rest has been
+ *		  used, interrupts included.
+ *		- Static RAM and code size of every section are in the
+ *		  .map file MPLINK writes next to the .cof.
+ */
+
+#define STACK_BASE			0x200		/* gpr2, STACK SIZE=0x100 RAM=gpr2 in 18f4431.lkr */
+#define STACK_SIZE			0x100
+#define STACK_PAINT			0xA5
+#define STACK_LEVELS		31			/* Hardware return stack depth */
+
+#define StackSample()		{if((STKPTR&0x1F)>StackDepth) StackDepth=STKPTR&0x1F;}
+
+extern unsigned char StackDepth;				/* Deepest return stack level seen */
+extern unsigned char StackFlags;				/* STKFUL and STKUNF found at start-up */
+
+
+/* OpenStack
+ * Takes the stack error flags and paints the free software stack, call first in main()
+ */
+void OpenStack(void);
+
+/* StackReport
+ * Writes the return stack and software stack use over the EUSART
+ */
+void StackReport(void);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __P18F4431_H
+#define __P18F4431_H
+
+/* PC stand-in for the MPLAB C18 device header.
+ *
+ *   Notes:
+ *		- Only the registers read or written by the modules built
+ *		  for the host tests are declared, as plain variables the
+ *		  test sets and checks (refer test_encoder.c and
+ *		  test_control.c). Bits are declared in a struct of the
+ *		  bits used, not at their place in the register.
+ *		- rom data is ordinary const data on the PC.
+ *		- int is 32 bits on the PC, 16 bits on the PIC: traces keep
+ *		  16 bit values from wrapping and counts are compared in
+ *		  16 bits.
+ */
+
+#define rom
+
+extern unsigned char TMR0L, TMR0H, T0CON;
+extern unsigned char TMR1L, TMR1H;
+
+extern struct INTCONBITS { unsigned GIEL:1, GIEH:1; } INTCONbits;
+extern struct INTCON2BITS { unsigned INTEDG2:1; } INTCON2bits;
+extern struct INTCON3BITS { unsigned INT2IF:1, INT2IE:1, INT2IP:1; } INTCON3bits;
+extern struct PIE1BITS { unsigned TMR1IE:1; } PIE1bits;
+extern struct PIR1BITS { unsigned TMR1IF:1; } PIR1bits;
+
+#endif
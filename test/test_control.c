@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <string.h>
+#include <p18f4431.h>
+#include "control.h"
+#include "motor.h"
+#include "trace.h"
+#include "serial.h"
+
+/* Golden trace test of the position controller (control.c, default
+ * build: position PID at 100Hz).
+ *
+ * Each trace file runs ControlUpdate() on axis 0, one line per tick:
+ *
+ *		# comment
+ *		open
+ *		<setpoint> <position> <speed> <direction>
+ *
+ * open calls OpenControl() and enables the PID of axis 0. On every
+ * other line a new <setpoint> is set with SetPosition() as MoveTo()
+ * does, <position> is the encoder count of the tick (no fraction, the
+ * edge speed is the change of count since the last tick) and the
+ * motor drive of the tick is compared: <speed> 0-255 and <direction>
+ * ccw, cw or brake as MotorOutput() sets them, coast or hold with
+ * speed 0 when MotorHold() parks the axis, none when a parked tick
+ * leaves the drive as it was. With -p the lines are written as run
+ * instead of compared. With -m the positions are replaced by those of
+ * MotorModel() driven by the last output, to write a new trace from a
+ * list of setpoints.
+ *
+ * int is 32 bits here: a 16 bit overflow in control.c, such as the Q4
+ * error of a long step before it was clamped, does not show. long.txt
+ * checks the drive of a long step, not the overflow itself.
+ */
+
+#define MODEL_FREE		130			/* Drive under which the model shaft does not turn */
+#define MODEL_FULL		(9*16)		/* Q4 counts per tick at full drive (refer control.h) */
+#define MODEL_LAG		3			/* Speed time constant, ticks */
+
+unsigned char TMR0L, TMR0H, T0CON;
+unsigned char TMR1L, TMR1H;
+struct INTCONBITS INTCONbits;
+struct INTCON2BITS INTCON2bits;
+struct INTCON3BITS INTCON3bits;
+struct PIE1BITS PIE1bits;
+struct PIR1BITS PIR1bits;
+
+unsigned int FinePosition[NUM_AXES];
+signed int EdgeSpeed[NUM_AXES];
+
+static unsigned int DriveSpeed;
+static const char *DriveDirection;
+static signed long ModelSpeed, ModelPosition;		// Q4
+
+void MotorOutput(unsigned char axis, signed int speed)
+{
+	if(axis!=0) return;
+	if(speed>0)
+	{
+		DriveSpeed = speed;
+		DriveDirection = "ccw";
+	}
+	else if(speed<0)
+	{
+		DriveSpeed = -speed;
+		DriveDirection = "cw";
+	}
+	else
+	{
+		DriveSpeed = 0;
+		DriveDirection = "brake";
+	}
+}
+
+void MotorHold(unsigned char axis, unsigned char hold)
+{
+	if(axis!=0) return;
+	DriveSpeed = 0;
+	DriveDirection = (hold==MOTOR_HOLD_BRAKE) ? "hold" : "coast";
+}
+
+void TraceRecord(unsigned int Position, unsigned int Setpoint, signed char Fraction, unsigned char Offset, unsigned int Timer, signed int Integral, signed int Output)
+{
+	(void)Position; (void)Setpoint; (void)Fraction; (void)Offset;
+	(void)Timer; (void)Integral; (void)Output;
+}
+void TraceTrigger(void) { }
+
+void putcSerial(char c) { (void)c; }
+void putrsSerial(const rom char *s) { (void)s; }
+void puthexSerial(unsigned int Value) { (void)Value; }
+
+
+/********************************************************************
+*       Function Name:  MotorModel                                  *
+*       Return Value:   unsigned int: position of the next tick     *
+*       Parameters:     void                                        *
+*       Description:    This routine moves a model shaft for one    *
+*                       tick of the last drive: the speed follows   *
+*                       the drive above MODEL_FREE with a lag of    *
+*                       MODEL_LAG ticks, braked or parked it stops. *
+********************************************************************/
+static unsigned int MotorModel(void)
+{
+	signed long Target;
+
+	Target = 0;
+	if((DriveSpeed>MODEL_FREE)&&(strcmp(DriveDirection, "ccw")==0))
+		Target = (signed long)(DriveSpeed-MODEL_FREE)*MODEL_FULL/(255-MODEL_FREE);
+	else if((DriveSpeed>MODEL_FREE)&&(strcmp(DriveDirection, "cw")==0))
+		Target = -(signed long)(DriveSpeed-MODEL_FREE)*MODEL_FULL/(255-MODEL_FREE);
+	ModelSpeed += (Target-ModelSpeed)/MODEL_LAG;
+	ModelPosition += ModelSpeed;
+	return (unsigned int)(ModelPosition>>4);
+}
+
+
+/********************************************************************
+*       Function Name:  RunTrace                                    *
+*       Return Value:   int: number of lines that did not match     *
+*       Parameters:     Name: trace file                            *
+*                       Print: write the lines as run instead,      *
+*                       2: with the positions of MotorModel()       *
+*       Description:    This routine replays one trace file.        *
+********************************************************************/
+static int RunTrace(const char *Name, int Print)
+{
+	FILE *f;
+	char Line[128], Direction[8];
+	unsigned int Setpoint, Position, Speed;
+	int Number, Failed;
+
+	f = fopen(Name, "r");
+	if(f==NULL)
+	{
+		printf("%s: cannot open\n", Name);
+		return 1;
+	}
+	Number = 0;
+	Failed = 0;
+	while(fgets(Line, sizeof(Line), f))
+	{
+		Number++;
+		if((Line[0]=='#')||(Line[0]=='\n'))
+		{
+			if(Print) fputs(Line, stdout);
+			continue;
+		}
+		if(strncmp(Line, "open", 4)==0)
+		{
+			OpenControl();
+			PIDEnable = 1;
+			DriveSpeed = 0;
+			DriveDirection = "brake";
+			ModelSpeed = 0;
+			ModelPosition = 0;
+			if(Print) fputs(Line, stdout);
+			continue;
+		}
+		if(sscanf(Line, "%u %u %u %7s", &Setpoint, &Position, &Speed, Direction)!=4)
+		{
+			printf("%s:%d: bad line\n", Name, Number);
+			Failed++;
+			continue;
+		}
+		if(Print==2) Position = MotorModel();
+		if(Setpoint!=DesirePosition[0]) SetPosition(0, Setpoint);
+		EdgeSpeed[0] = (signed int)(Position-CurrentPosition[0])<<4;	// Q4 counts per 10ms tick
+		CurrentPosition[0] = Position;
+		FinePosition[0] = Position<<4;
+		TMR1_RELOAD;					// Tick starts at the reload, no overrun
+		PIR1bits.TMR1IF = 0;
+		DriveSpeed = 0;
+		DriveDirection = "none";
+		ControlUpdate();
+		if(Print)
+			printf("%u %u %u %s\n", Setpoint, Position, DriveSpeed, DriveDirection);
+		else if((DriveSpeed!=Speed)||strcmp(DriveDirection, Direction))
+		{
+			printf("%s:%d: expected %u %s, got %u %s\n", Name, Number,
+				Speed, Direction, DriveSpeed, DriveDirection);
+			Failed++;
+		}
+	}
+	fclose(f);
+	if(!Print) printf("%s: %s\n", Name, Failed ? "FAIL" : "ok");
+	return Failed;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int i, Print, Failed;
+
+	Print = 0;
+	Failed = 0;
+	for(i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-p")==0) Print = 1;
+		else if(strcmp(argv[i], "-m")==0) Print = 2;
+		else if(RunTrace(argv[i], Print)) Failed++;
+	}
+	return Failed ? 1 : 0;
+}
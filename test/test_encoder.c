@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <string.h>
+#include <p18f4431.h>
+#include "control.h"
+#include "encoder.h"
+#include "serial.h"
+
+/* Golden trace test of the software quadrature decoder (encoder.c).
+ *
+ * Each trace file drives QuadDecode() on axis 0 and holds the decoder
+ * state expected after every edge:
+ *
+ *		# comment
+ *		open <state>
+ *		stop
+ *		<timer> <state> <count> <errors> <glitches>
+ *
+ * open calls OpenEncoder() with the starting channel state. stop runs
+ * EncoderSample() for ENCODER_STOP_TICKS control ticks without a count
+ * (one more for the last count), as when the shaft stops. Every other
+ * line sets Timer 0 to <timer> (1.6us counts), calls QuadDecode() with
+ * <state> = (B<<1)|A and compares EncoderCount (16 bits, hex),
+ * EncoderErrors and EncoderGlitches. With -p the lines are written as
+ * decoded instead of compared, to write a new trace after a change of
+ * behaviour that was meant.
+ */
+
+unsigned char TMR0L, TMR0H, T0CON;
+
+void putcSerial(char c) { (void)c; }
+void putrsSerial(const rom char *s) { (void)s; }
+void puthexSerial(unsigned int Value) { (void)Value; }
+
+
+/********************************************************************
+*       Function Name:  RunTrace                                    *
+*       Return Value:   int: number of lines that did not match     *
+*       Parameters:     Name: trace file                            *
+*                       Print: write the decoded lines instead      *
+*       Description:    This routine replays one trace file.        *
+********************************************************************/
+static int RunTrace(const char *Name, int Print)
+{
+	FILE *f;
+	char Line[128];
+	unsigned int Timer, State, Count, Errors, Glitches, Got;
+	int Number, Failed, Tick;
+
+	f = fopen(Name, "r");
+	if(f==NULL)
+	{
+		printf("%s: cannot open\n", Name);
+		return 1;
+	}
+	Number = 0;
+	Failed = 0;
+	while(fgets(Line, sizeof(Line), f))
+	{
+		Number++;
+		if((Line[0]=='#')||(Line[0]=='\n'))
+		{
+			if(Print) fputs(Line, stdout);
+			continue;
+		}
+		if(sscanf(Line, "open %u", &State)==1)
+		{
+			OpenEncoder(0, State);
+			if(Print) fputs(Line, stdout);
+			continue;
+		}
+		if(strncmp(Line, "stop", 4)==0)
+		{
+			for(Tick=0; Tick<=ENCODER_STOP_TICKS; Tick++)
+				EncoderSample(0, EncoderCount[0], 0xFFFF, 0xFFFF, 0);
+			if(Print) fputs(Line, stdout);
+			continue;
+		}
+		if(sscanf(Line, "%u %u %x %u %u", &Timer, &State, &Count, &Errors, &Glitches)!=5)
+		{
+			printf("%s:%d: bad line\n", Name, Number);
+			Failed++;
+			continue;
+		}
+		TMR0L = Timer & 0xFF;
+		TMR0H = (Timer>>8) & 0xFF;
+		QuadDecode(0, State);
+		Got = EncoderCount[0] & 0xFFFF;
+		if(Print)
+			printf("%u %u %04X %u %u\n", Timer, State, Got, EncoderErrors[0], EncoderGlitches[0]);
+		else if((Got!=Count)||(EncoderErrors[0]!=Errors)||(EncoderGlitches[0]!=Glitches))
+		{
+			printf("%s:%d: expected %04X %u %u, got %04X %u %u\n", Name, Number,
+				Count, Errors, Glitches, Got, EncoderErrors[0], EncoderGlitches[0]);
+			Failed++;
+		}
+	}
+	fclose(f);
+	if(!Print) printf("%s: %s\n", Name, Failed ? "FAIL" : "ok");
+	return Failed;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int i, Print, Failed;
+
+	Print = 0;
+	Failed = 0;
+	for(i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-p")==0) Print = 1;
+		else if(RunTrace(argv[i], Print)) Failed++;
+	}
+	return Failed ? 1 : 0;
+}
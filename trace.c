@@ -0,0 +1,117 @@
+#include <p18f4431.h>
+#include "trace.h"
+#include "control.h"
+#include "serial.h"
+#include "stack.h"
+
+#pragma udata trace_buffer
+static TRACE_RECORD TraceBuffer[TRACE_LENGTH];
+#pragma udata
+
+unsigned char TraceState;
+static unsigned char TraceIndex, TraceCount, TracePost;
+
+
+/********************************************************************
+*       Function Name:  OpenTrace                                   *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine empties the buffer and arms    *
+*                       the trigger.                                *
+********************************************************************/
+void OpenTrace(void)
+{
+	TraceState = TRACE_FROZEN;		// Keep TraceRecord() out while clearing
+	TraceIndex = 0;
+	TraceCount = 0;
+	TracePost = 0;
+	TraceState = TRACE_RUN;
+}
+
+
+/********************************************************************
+*       Function Name:  TraceRecord                                 *
+*       Return Value:   void                                        *
+*       Parameters:     Inputs and output of one control tick       *
+*       Description:    This routine writes one record over the     *
+*                       oldest one and counts the records after a   *
+*                       trigger.                                    *
+********************************************************************/
+void TraceRecord(unsigned int Position, unsigned int Setpoint, signed char Fraction, unsigned char Offset, unsigned int Timer, signed int Integral, signed int Output)
+{
+	StackSample();
+	if(TraceState==TRACE_FROZEN) return;
+
+	TraceBuffer[TraceIndex].Position = Position;
+	TraceBuffer[TraceIndex].Setpoint = Setpoint;
+	TraceBuffer[TraceIndex].Fraction = Fraction;
+	TraceBuffer[TraceIndex].Offset = Offset;
+	TraceBuffer[TraceIndex].Timer = Timer;
+	TraceBuffer[TraceIndex].Integral = Integral;
+	TraceBuffer[TraceIndex].Output = Output;
+	if(++TraceIndex>=TRACE_LENGTH) TraceIndex=0;
+	if(TraceCount<TRACE_LENGTH) TraceCount++;
+
+	if((TraceState==TRACE_TRIGGERED)&&(--TracePost==0)) TraceState = TRACE_FROZEN;
+}
+
+
+/********************************************************************
+*       Function Name:  TraceTrigger                                *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine starts the post-trigger count. *
+*                       Ignored if already triggered or frozen.     *
+********************************************************************/
+void TraceTrigger(void)
+{
+	if(TraceState!=TRACE_RUN) return;
+	TracePost = TRACE_POST;
+	TraceState = TRACE_TRIGGERED;
+}
+
+
+/********************************************************************
+*       Function Name:  TraceDump                                   *
+*       Return Value:   void                                        *
+*       Parameters:     void                                        *
+*       Description:    This routine writes the buffer oldest first *
+*                       over the EUSART. Recording is held during   *
+*                       the dump and resumes afterwards unless the  *
+*                       trace was frozen by a trigger.              *
+********************************************************************/
+void TraceDump(void)
+{
+	unsigned char State, i, n;
+
+	State = TraceState;
+	TraceState = TRACE_FROZEN;		// Hold the buffer while writing
+
+	putrsSerial("TRACE ");
+	puthexSerial(TraceCount);
+	putcSerial(' ');
+	puthexSerial(CONTROL_CASCADE);
+	putrsSerial("\r\n");
+
+	i = (TraceCount<TRACE_LENGTH) ? 0 : TraceIndex;		// Oldest record
+	for(n=0; n<TraceCount; n++)
+	{
+		puthexSerial(TraceBuffer[i].Position);
+		putcSerial(' ');
+		puthexSerial(TraceBuffer[i].Setpoint);
+		putcSerial(' ');
+		puthexSerial(TraceBuffer[i].Fraction);
+		putcSerial(' ');
+		puthexSerial(TraceBuffer[i].Offset);
+		putcSerial(' ');
+		puthexSerial(TraceBuffer[i].Timer);
+		putcSerial(' ');
+		puthexSerial(TraceBuffer[i].Integral);
+		putcSerial(' ');
+		puthexSerial(TraceBuffer[i].Output);
+		putrsSerial("\r\n");
+		if(++i>=TRACE_LENGTH) i=0;
+	}
+
+	TraceState = State;
+}
@@ -0,0 +1,93 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+/* Control tick trace recorder.
+ *
+ *   Notes:
+ *		- Every control tick of axis TRACE_AXIS is written to a
+ *		  ring buffer of TRACE_LENGTH records in RAM: position
+ *		  sample, setpoint, interpolated fraction (FinePosition
+ *		  less the position in Q4, -15 to 15), backlash offset
+ *		  added to the setpoint, Timer 1 count at the start of
+ *		  the update, controller integral before the step and
+ *		  the signed motor output passed to MotorOutput(). The
+ *		  integral is Sum_E[] of the position PID as kept, in Q4
+ *		  (16 = 1 output step), or VelocitySum[] of the velocity
+ *		  loop.
+ *		- The recorder freezes TRACE_POST ticks after a trigger,
+ *		  so the buffer holds the ticks before and after it.
+ *		  ControlUpdate() (control.c) triggers it on what normal
+ *		  moves do not produce:
+ *          - a fault of the axis (stall, overload, overrun), the
+ *            braked ticks are recorded with output 0;
+ *          - a runaway in position mode: with the setpoint
+ *            unchanged, an error over TRACE_TRIGGER_ERROR counts
+ *            that grows on TRACE_TRIGGER_TICKS ticks in a row.
+ *		  A setpoint step of any size is not a trigger, the error
+ *		  only shrinks after it. TraceTrigger() triggers on request.
+ *		- TraceDump() writes the records oldest first over the
+ *		  EUSART (serial.h), one line per tick in hex:
+ *		  "position setpoint fraction offset timer integral
+ *		  output". The first line is "TRACE <records>
+ *		  <CONTROL_CASCADE>".
+ *		- For the position PID (CONTROL_CASCADE = 0, position
+ *		  mode) a record holds every input of PositionPID(): the
+ *		  fine error is (error<<4) - fraction, with the error
+ *		  setpoint + offset - position clamped to +-1000, and
+ *		  the full Q4 integral restores Sum_E[]
+ *		  exactly. With the gains written by ConfigReport()
+ *		  the same controller built for a PC can replay a trace
+ *		  from the fourth record on and compare outputs bit for
+ *		  bit: the first three fill the derivative history and
+ *		  the gain band of the previous tick. A tick limited by
+ *		  CurrentLimit() (CURRENT_SENSE) does not match.
+ *		- The cascade and velocity mode use the edge speed,
+ *		  which is not recorded: their traces are for inspection
+ *		  only, not replay.
+ */
+
+#define TRACE_AXIS				0
+#define TRACE_LENGTH			20			/* 12 bytes per record, one RAM bank */
+#define TRACE_POST				10			/* Records kept after the trigger */
+#define TRACE_TRIGGER_ERROR		50			/* Least growing position error that triggers, counts */
+#define TRACE_TRIGGER_TICKS		3			/* Ticks in a row the error must grow */
+
+#define TRACE_RUN				0			/* Recording, trigger armed */
+#define TRACE_TRIGGERED			1			/* Recording the post-trigger records */
+#define TRACE_FROZEN			2			/* Buffer kept for TraceDump() */
+
+typedef struct
+{
+	unsigned int Position;
+	unsigned int Setpoint;
+	signed char Fraction;
+	unsigned char Offset;
+	unsigned int Timer;
+	signed int Integral;
+	signed int Output;
+} TRACE_RECORD;
+
+extern unsigned char TraceState;
+
+
+/* OpenTrace
+ * Clears the buffer and arms the trigger
+ */
+void OpenTrace(void);
+
+/* TraceRecord
+ * Writes one control tick, called from ControlUpdate()
+ */
+void TraceRecord(unsigned int Position, unsigned int Setpoint, signed char Fraction, unsigned char Offset, unsigned int Timer, signed int Integral, signed int Output);
+
+/* TraceTrigger
+ * Triggers the recorder, the buffer freezes TRACE_POST ticks later
+ */
+void TraceTrigger(void);
+
+/* TraceDump
+ * Writes the buffer over the EUSART, do not call from interrupts
+ */
+void TraceDump(void);
+
+#endif